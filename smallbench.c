@@ -0,0 +1,226 @@
+// File name:	smallbench.c
+// Description: Benchmark driver of smallsh. It starts the shell with its stdin and stdout on pipes, sends it the same
+//              command line N times, and after each line an echo of a marker, then waits for the marker before the
+//              next line. The time from writing a line until its marker is read is the latency of the line, as a
+//              user sees it (reading, parsing, expanding, running the command and reaping it, plus the echo built
+//              in function, run inside the shell). The number of lines per second and the exact 50th, 90th and 99th
+//              percentiles and the maximum of the latencies are printed at the end, after the resident size of the
+//              shell before the measure.
+//
+//              smallbench [-n N] [-w W] [-s shell] [-m MB] [-i line] command ...
+//
+//              -n N		number of lines measured, 1000 by default
+//              -w W		number of lines run first and not measured, 100 by default
+//              -s shell	the shell to measure, ./smallsh by default
+//              -m MB		the heap of the shell is grown first, by parallel true :::: over a file of MB megabytes of
+//              		blank lines (its arena keeps the blocks), to measure starting commands from a large shell
+//              -i line	a line sent once before the others, as set -o zygote
+//
+//              The words after the options are joined with spaces into the command line, which has to be given
+//              quoted to the shell starting smallbench when it has its own |, <, > or $. A command with newlines in it
+//              sends several lines each time, all of them before the marker, as $'repeat 100 /bin/true &\nwait'.
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#define MARKER "=smallbench=\n"
+
+// Nanoseconds of CLOCK_MONOTONIC
+long long monotonicNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Writes all of length bytes, exits if the shell is gone
+void writeFully(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0 && errno == EINTR) {continue;}
+    if (written < 0) {
+      perror("write to the shell");
+      exit(1);
+    }
+    data += written;
+    length -= written;
+  }
+}
+
+// Reads the output of the shell until the marker, the output before it is dropped. The bytes after the marker
+// (none, as the shell waits for the next line) are dropped too.
+void readMarker(int fd) {
+  static char buffer[65536];
+  size_t kept = 0;
+  size_t markerLength = strlen(MARKER);
+  while (1) {
+    ssize_t bytes = read(fd, buffer + kept, sizeof(buffer) - kept);
+    if (bytes < 0 && errno == EINTR) {continue;}
+    if (bytes <= 0) {
+      fprintf(stderr, "smallbench: the shell ended before the marker\n");
+      exit(1);
+    }
+    kept += bytes;
+    if (memmem(buffer, kept, MARKER, markerLength)) {return;}
+    // only the end which can be the start of the marker is kept
+    if (kept >= markerLength) {
+      memmove(buffer, buffer + kept - (markerLength - 1), markerLength - 1);
+      kept = markerLength - 1;
+    }
+  }
+}
+
+// Resident size of the process in kB, from its VmRSS line in /proc, -1 if it cannot be read
+long residentKb(pid_t pid) {
+  char path[64], text[4096];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {return -1;}
+  ssize_t bytes = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  if (bytes <= 0) {return -1;}
+  text[bytes] = '\0';
+  char *line = strstr(text, "VmRSS:");
+  return line ? atol(line + 6) : -1;
+}
+
+// Sends a line to the shell, followed by the marker, and waits for the marker
+void runSetup(int toShell, int fromShell, const char *setup) {
+  writeFully(toShell, setup, strlen(setup));
+  writeFully(toShell, "\necho " MARKER, strlen("\necho " MARKER));
+  readMarker(fromShell);
+}
+
+int compareLatency(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+// Latency at the given fraction of the sorted latencies (nearest rank), in microseconds
+double percentileUs(long long *sorted, int count, double fraction) {
+  int rank = (int)(count * fraction + 0.999999);
+  if (rank < 1) {rank = 1;}
+  return sorted[rank - 1] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+  int count = 1000, warmup = 100;
+  const char *shell = "./smallsh";
+  const char *setup = NULL;
+  int heapMb = 0;
+  int k = 1;
+  for (; k < argc && argv[k][0] == '-'; k += 2) {
+    if (k + 1 >= argc) {break;}
+    if (strcmp(argv[k], "-n") == 0) {
+      count = atoi(argv[k + 1]);
+    } else if (strcmp(argv[k], "-w") == 0) {
+      warmup = atoi(argv[k + 1]);
+    } else if (strcmp(argv[k], "-s") == 0) {
+      shell = argv[k + 1];
+    } else if (strcmp(argv[k], "-m") == 0) {
+      heapMb = atoi(argv[k + 1]);
+    } else if (strcmp(argv[k], "-i") == 0) {
+      setup = argv[k + 1];
+    } else {
+      break;
+    }
+  }
+  if (k >= argc || count < 1 || warmup < 0 || heapMb < 0) {
+    fprintf(stderr, "usage: smallbench [-n N] [-w W] [-s shell] [-m MB] [-i line] command ...\n");
+    return 2;
+  }
+
+  // the line sent each time: the command followed by the marker
+  size_t length = strlen("\necho " MARKER);
+  for (int a = k; a < argc; a++) {length += strlen(argv[a]) + 1;}
+  char *line = malloc(length + 1);
+  char *end = line;
+  for (int a = k; a < argc; a++) {
+    end = stpcpy(end, argv[a]);
+    *end++ = (a + 1 < argc) ? ' ' : '\n';
+  }
+  end = stpcpy(end, "echo " MARKER);
+
+  int toShell[2], fromShell[2];
+  if (pipe(toShell) < 0 || pipe(fromShell) < 0) {
+    perror("pipe");
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork()");
+    return 1;
+  }
+  if (pid == 0) {
+    dup2(toShell[0], 0);
+    dup2(fromShell[1], 1);
+    close(toShell[0]);
+    close(toShell[1]);
+    close(fromShell[0]);
+    close(fromShell[1]);
+    execl(shell, shell, (char *)NULL);
+    perror(shell);
+    exit(127);
+  }
+  close(toShell[0]);
+  close(fromShell[1]);
+
+  if (heapMb > 0) {
+    char blankPath[] = "/tmp/smallbench.XXXXXX";
+    int fd = mkstemp(blankPath);
+    if (fd < 0) {
+      perror("mkstemp");
+      return 1;
+    }
+    static char blanks[65536];
+    memset(blanks, '\n', sizeof(blanks));
+    for (long written = 0; written < heapMb * 1048576L; written += sizeof(blanks)) {
+      writeFully(fd, blanks, sizeof(blanks));
+    }
+    close(fd);
+    char grow[128];
+    snprintf(grow, sizeof(grow), "parallel true :::: %s", blankPath);
+    runSetup(toShell[1], fromShell[0], grow);
+    unlink(blankPath);
+  }
+  if (setup) {
+    runSetup(toShell[1], fromShell[0], setup);
+  }
+  long resident = residentKb(pid);
+  long long *latencies = malloc(count * sizeof(long long));
+  for (int i = 0; i < warmup; i++) {
+    writeFully(toShell[1], line, end - line);
+    readMarker(fromShell[0]);
+  }
+  long long started = monotonicNs();
+  for (int i = 0; i < count; i++) {
+    long long sent = monotonicNs();
+    writeFully(toShell[1], line, end - line);
+    readMarker(fromShell[0]);
+    latencies[i] = monotonicNs() - sent;
+  }
+  long long total = monotonicNs() - started;
+
+  close(toShell[1]);
+  close(fromShell[0]);
+  waitpid(pid, NULL, 0);
+
+  qsort(latencies, count, sizeof(long long), compareLatency);
+  printf("shell resident %ld kB\n", resident);
+  printf("%d lines in %.3f s, %.0f lines/s\n", count, total / 1e9, count / (total / 1e9));
+  printf("latency_us p50 %.1f p90 %.1f p99 %.1f max %.1f\n", percentileUs(latencies, count, 0.5),
+      percentileUs(latencies, count, 0.9), percentileUs(latencies, count, 0.99), latencies[count - 1] / 1000.0);
+  free(latencies);
+  free(line);
+  return 0;
+}
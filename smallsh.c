@@ -1,528 +1,4675 @@
-// Author:      Serkan Bayramoglu
-// Email:       bayramos@oregonstate.edu
-// Date:        July 24, 2022
-// Description: This project provides a small shell to the user. The program has 3 built in functions; cd for changing 
-//              the working directory, status for providing the exit value of the termination signal number of the most recent 
-//              background process, and  exit for exiting the proram. The program uses execvp() to execute all other command 
-//              line commands using child processes. The program allows for a maximum length of 2048 characters consisting of 
-//              a maximum of 512 arguments (incl. input / output redirections and background processing symbols, and the 
-//              commands. The character '<' stands for input redirection, '>' for output redirection, and '&' (if at the end) 
-//              for background processing. the '<' and '>' characters can be in any order, each followed by their respective 
-//              file names,before & (if there is any background processing request), however, after all other arguments. 
-//              Otherwise they are considered as ordinary strings to be used as arguments for the previous commands. The 
-//              program allows for consecutive spaces before, in between or after the arguments, which are not taken into 
-//              consideration. However, there must be at least one space between each argument. Built in commands cannot run 
-//              on background. Any command ending with & (other than the built in commands) will run at the background while 
-//              the rest run on the foreground. Number of processes running on the background cannot exceed 100. One or more 
-//              process have to be completed or terminated in order to start a new process on the backgroun. For redirection 
-//              of standard input and / or output. The dup2() function is used in the program. Spaces inside arguments are not 
-//              allowed, and quoting is not supported. The | pipe operator is also not implemented. The program does not take 
-//              into consideration the blank lines when entered, and any lines that start with '#' character. '$$' is the 
-//              expansion string, which is replaced by the program with the pid number of the parent process. The SIGINT signal
-//              is ignored by the parent process and any background processes. However, when received by the foreground child
-//              process, the child process kills itself, and afterwards the parent process prints out the number of the signal
-//              that killed the foreground child process before prompting the user for the next input. All foreground and 
-//              background processes ignore the SIGSTP signal, while the parent, each time received while the parent is active, 
-//              the shell switches alternatively between normal mode and foregrounf mode. When the shell is in the foreground
-//              mode, even the user entries ending with '&' are processed in the foreground, and no new background process is 
-//              accepted.  
-
-
-#define _POSIX_SOURCE
-#include <signal.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <stdint.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <fcntl.h>
-
-// Constants
-#define MAX_LEN 2048
-#define MAX_ARG 512
-
-// Global variables to be used by both, handlers and main, and make all communicate
-int fgOnlyMode;
-int signalInter;
-pid_t childPids [101] = {0};
-
-
-// Handler for SIGNCHLD to print pid numbers and termination signal numbers on stdout when signal is received on child processes
-void handle_SIGCHLD(int signo){
-  if (signo != 0) {
-    for(int childNo2 = 0; childNo2 < 100; childNo2++) { 
-      if (childPids[childNo2] > 0) {
-        pid_t w = -5;
-        int childStatus2;
-        w = waitpid(childPids[childNo2], &childStatus2, WNOHANG);
-        if (w < 0) {
-          perror("waitpid");
-          exit(1);
-        }
-        if (w > 0) { 
-          if(WIFEXITED(childStatus2)){
-            printf("background pid %d is done: exit value %d\n", childPids[childNo2], WEXITSTATUS(childStatus2));
-            fflush(stdout);
-          } 
-          if (WIFSIGNALED(childStatus2)) {
-            printf("background pid %d is done: terminated by signal %d\n", childPids[childNo2], WTERMSIG(childStatus2));
-            fflush(stdout);
-          }
-          childPids[childNo2] = 0 ;
-        }
-      }
-    } 
-  }
-  signalInter = 1;   // tell perror on row 163, that the cause for the err message is the SGCHLD signal, not the fgets() above it
-}  
-  
-// Handler for SIGNTSTP to manage switcing to and from the foreground only mode
-void handle_SIGTSTP(int signo){
-  char* message1 = "\nEntering foreground-only mode (& is now ignored)\n";
-  char* message2 = "\nExiting foreground-only mode\n";
-  if (fgOnlyMode) {
-    write(1,message2,30);
-    fgOnlyMode = 0;
-  } else {
-    write(1,message1,50);
-    fgOnlyMode = 1;
-  }
-  signalInter = 1;   // same as row 80 above, used to tell perror that the err message is related to the signal received
-}
-
-
-int main() {
-  // List of the variables for the main func
-  char readBufferInit [MAX_LEN + 2];
-  pid_t mainpid = -5;
-  ssize_t readLength;
-  int argSize;
-  char ch[2];
-  int j;
-  char mainpidstr[10];
-  int childNo = 0;
-  int fd_i, fd_o;
-  int lastStatusType = 0;         // 0 if exit, 1 if terminated, to be used by the status command
-  int lastStatus = 0;
-  
-  // Initializations
-  fgOnlyMode = 0;
-  signalInter = 0;
-  sigset_t signal_set_ch;
-  sigemptyset (&signal_set_ch);
-  sigaddset(&signal_set_ch, SIGTSTP);
-
-  // Obtaining process id of the parent
-  mainpid = getpid();
-
-  // Converting int to string, to be used to replace $$, as strcat() does not take integer args
-  sprintf(mainpidstr, "%d", mainpid);   
-
-  // Creating signal handlers for SIGTSTP and SIGCHLD
-  struct sigaction ignore_action = {0}, SIGTSTP_action = {0}, SIGCHLD_action = {0};
-
-  // Filling out the SIGTSTP_action struct, Registering handle_SIGTSTP as the signal handler, No flags set
-  SIGTSTP_action.sa_handler = handle_SIGTSTP;
-  sigfillset(&SIGTSTP_action.sa_mask);
-  SIGTSTP_action.sa_flags = 0;
-  sigaction(SIGTSTP, &SIGTSTP_action, NULL);
-
-  // Filling out the SIGCHLD_action struct, Registering handle_SIGCHLD as the signal handler, No flags set
-  SIGCHLD_action.sa_handler = handle_SIGCHLD;
-  sigfillset(&SIGCHLD_action.sa_mask);
-  SIGCHLD_action.sa_flags = 0;
-  sigaction(SIGCHLD, &SIGCHLD_action, NULL);
-  
-  
-  // --------------------------------------------------------------------------------------------------
-  // loop asking for input until exit entered as the command
-  // --------------------------------------------------------------------------------------------------
-  
-  while (1) {
-    // The ignore_action struct as SIG_IGN its signal handler to have SIGINT ignored by whoever will need
-    ignore_action.sa_handler = SIG_IGN;
-    // Registering the ignore_action as the handler for SIGINT.
-    sigaction(SIGINT, &ignore_action, NULL);
-    
-    
-    // --------------------------------------------------------------------------------------------------
-    // Prompt for user input, store the input in readBufferInit, check MAX_LEN and MAX_ARG not exceeded
-    // --------------------------------------------------------------------------------------------------
-   
-    // print : as the prompt
-    write(1,":",1);
-
-    // clean the buffer, receive an input check the length
-    memset(readBufferInit, '\0', sizeof(readBufferInit));
-
-    if (fgets(readBufferInit, MAX_LEN + 2, stdin) == NULL) {
-      if (!signalInter) {                                      
-        perror("Command input");
-        exit(1);
-      }
-    }
-
-    readLength = strlen(readBufferInit);
-
-    // set to 0 for the next while loop
-    signalInter = 0;
-
-    // character +1 is character no 2049,for the '\0', length will be +2 if the input exceeds 2048 character (excl the '\0') 
-    if (readLength > MAX_LEN + 1){
-      write(2,"You exceeded the command length. Please try again!\n",53); 
-      continue;
-    }
-
-    // when entered on the command line, the last character ends with \n, while with input redirect, it may not be the case
-    if (readBufferInit[readLength-1] == '\n') {
-      readBufferInit[readLength-1] = '\0';
-      readLength -=1;
-    }
-
-    // consecutive blank spaces at the beginning are disregared - searching for the first argument. 
-    argSize = 0;
-    memset(ch, '\0', sizeof(ch));
-    j = 0;
-    while (readBufferInit[j] != '\0') {
-      if (readBufferInit[j] != ' ') {
-        argSize = 1;
-        break;
-      }
-      j++;
-    }
-    // Continue to the next prompt if no argument found or line starts with "#"
-    if (argSize == 0) {
-      continue;
-    }
-    if (readBufferInit[j] == '#') {
-      continue;
-    }
-    // Find number of arguments, return error if it is larger than MAX_ARG
-    while (readBufferInit[j] != '\0') {
-      ch[0] = readBufferInit[j]; 
-      if (strcmp(ch, " ") == 0) {
-        ch[0] = readBufferInit[j+1]; 
-        if ((strcmp(ch, " ") != 0) && (strcmp(ch, "\0")) != 0) {
-          argSize++;
-        }
-      }
-      j++;
-    }
-    if (argSize > MAX_ARG){
-      write(2,"You exceeded the command length. Please try again!\n",53); 
-      continue;
-    }
-    
-    // --------------------------------------------------------------------------------------------------
-    // Replace $$ in the user input with mainpid and create readBuffer to paste from readBufferInit
-    // --------------------------------------------------------------------------------------------------
-
-    // find number of "$$" to be replaced
-    int replaceCount = 0;
-    char substr[3] = "$$";
-    substr[2] = '\0';
-    j = 0;
-    while (readBufferInit[j+1] != '\0') {
-      if ((readBufferInit[j] == substr[0]) && (readBufferInit[j+1] == substr[1])) {
-        replaceCount++;
-        j++;
-      }
-      j++;
-    }
-    
-    // create new array for the replacement of "$$", because size of initial array may not be sufficient 
-    int newSize = strlen(readBufferInit) + (replaceCount * (strlen(mainpidstr) - 2));
-    char readBuffer [newSize+1];
-    memset(readBuffer, '\0', sizeof(readBuffer));
-
-    // initiate variables to paste readBufferInit into readBuffer, replacing "$$"s and removing extra spaces
-    j = 0;
-
-    // do not paste to the new array the initial space characters " "
-    while (readBufferInit[j] == ' ') {j++;}
-      
-    // Paste remaining - remaining spaces will be taken care of by the strtok later below
-    while (readBufferInit[j] != '\0') {
-      if ((readBufferInit[j] == substr[0]) && (readBufferInit[j+1] == substr[1])) {
-        if (readBuffer == NULL) {
-          strcpy(readBuffer, mainpidstr);
-        } else {
-          strcat(readBuffer, mainpidstr);
-        }
-        j++;
-      } else {
-        ch[0] = readBufferInit[j];
-        ch[1] = '\0';
-        if (readBuffer == NULL) {
-          strcpy(readBuffer, ch);
-        } else {
-          strcat(readBuffer, ch);
-        }
-      }
-      j++;
-    }
-
-    // --------------------------------------------------------------------------------------------------
-    // Create the arguments array with the size of number of args + 1 (1 additional NULL arg in the end)
-    // --------------------------------------------------------------------------------------------------
-    
-    char *enteredargs[argSize + 1];
-    char * token = strtok(readBuffer, " ");
-    // parse the first argument (the command) and add to array[0]
-    if (token != NULL) {
-      enteredargs[0] = (char*)malloc(strlen(token)*sizeof(char));
-      strcpy(enteredargs[0],token);
-    } 
-    // parse the rest arguments
-    int i = 1;
-    while( token != NULL ) {
-      token = strtok(NULL, " ");
-      if (token != NULL) {
-        enteredargs[i] = (char*)malloc(strlen(token)*sizeof(char));
-        strcpy(enteredargs[i],token);
-        i++;
-      } else {
-      // last arg set to NULL
-      enteredargs[i] = NULL;
-      }
-    }
-
-    // --------------------------------------------------------------------------------------------------
-    // Cleanup and organize enteredargs for &, < and > (redirection and background commands)
-    // --------------------------------------------------------------------------------------------------
-
-    int isBg = 0;
-    int hasInpRed = 0;
-    char *inputFile;
-    int hasOutRed = 0;
-    char *outputFile;
-    int checkingIndex = argSize - 1;
-    
-    // if the last non-null argument in the array is &, a seperate variable isBg is set to 1
-    if (strcmp(enteredargs[checkingIndex], "&") == 0) {
-      // this is a bg process
-      isBg = 1;
-      // the array is set to null, as it needs to be cleaned for exec() function
-      enteredargs[checkingIndex] = NULL;
-      checkingIndex--;
-    }
-    // if there existed & in the end, the last index will reduce by 1
-    checkingIndex--;
-    // having the & set to null, there are two alternatives; either the last two arguments are related to input 
-    // redirection, in this case the previous two may or may not be related to input redirection, or the last or vice versa:
-
-    //1- check if the last arg is input redirection
-    if (strcmp(enteredargs[checkingIndex], "<") == 0) {
-      // this is input redirection
-      hasInpRed = 1;
-      inputFile = (char*)malloc(strlen(enteredargs[checkingIndex + 1])*sizeof(char));
-      strcpy(inputFile, enteredargs[checkingIndex + 1]);   
-      enteredargs[checkingIndex + 1] = NULL;
-      enteredargs[checkingIndex] = NULL;
-      checkingIndex -= 2;
-      // check if there was output redirection before input redirection
-      if (strcmp(enteredargs[checkingIndex], ">") == 0) {
-        // this is output redirection
-        hasOutRed = 1;
-        outputFile = (char*)malloc(strlen(enteredargs[checkingIndex + 1])*sizeof(char));
-        strcpy(outputFile, enteredargs[checkingIndex + 1]);   
-        enteredargs[checkingIndex + 1] = NULL;
-        enteredargs[checkingIndex] = NULL;
-      }
-    }
-    //2- check if the last arg is output redirection
-    if (strcmp(enteredargs[checkingIndex], ">") == 0) {
-      // this is output redirection
-      hasOutRed = 1;
-      outputFile = (char*)malloc(strlen(enteredargs[checkingIndex + 1])*sizeof(char));
-      strcpy(outputFile, enteredargs[checkingIndex + 1]);   
-      enteredargs[checkingIndex + 1] = NULL;
-      enteredargs[checkingIndex] = NULL;
-      checkingIndex -= 2;
-      // check if there was input redirection before output redirection
-      if (strcmp(enteredargs[checkingIndex], "<") == 0) {
-        // this is input redirection
-        hasInpRed = 1;
-        inputFile = (char*)malloc(strlen(enteredargs[checkingIndex + 1])*sizeof(char));
-        strcpy(inputFile, enteredargs[checkingIndex + 1]);   
-        enteredargs[checkingIndex + 1] = NULL;
-        enteredargs[checkingIndex] = NULL;
-      }
-    }
-
-    // --------------------------------------------------------------------------------------------------
-    // After having organized the args array, process the user input
-    // --------------------------------------------------------------------------------------------------
-    
-    // built in commands
-    if (strcmp(enteredargs[0], "cd") == 0) {
-      if (enteredargs[1]) {
-        if(chdir(enteredargs[1])) {
-          perror(enteredargs[1]);
-        }
-      } else { 
-        if(chdir(getenv("HOME"))) {
-          perror("HOME directory not defined");
-        } 
-      }
-    } else if (strcmp(enteredargs[0], "exit") == 0) {
-      // kill the children
-      for(int i=0;i<101;i++){
-        if (childPids[i] > 0) {kill(childPids[i], SIGKILL);}
-      }
-      // terminate the parent
-      exit(0);
-
-    } else if (strcmp(enteredargs[0], "status") == 0) {
-      if (lastStatusType) {
-        printf("terminated by signal %d\n", lastStatus);    
-        fflush(stdout);
-      } else {
-        printf("exit value %d\n", lastStatus);    
-        fflush(stdout);
-      }
-    } else {
-      
-      // non built in commands
-      
-      int childStatus;
-
-      // if a background process is entered, check the childPids buffer is not full, otherwise prompt the user to wait
-      if ((isBg) && (!fgOnlyMode)) {
-        int count = 0;
-        for(int i=0; i<101; i++){
-          if (childPids[i] == 0 ) {count++;}
-        } 
-        // to ensured that there is an extra empty spot, after one being used now, 
-        // as the child no will move to the next spot later below
-        if (count < 2) {
-        printf("Cannot start new background process, 100 processes running in the background.\n" 
-            "Please wait until a background process ends.\n");
-        // disregard the last command, go to the beginning of while look, and reprompt
-        continue;
-        }
-      }
-      // fork the child to start the new process
-      pid_t spawnPid = fork();
-      if(spawnPid== -1) {
-        perror("fork()");
-        exit(1);
-      
-      } else if (spawnPid == 0) {
-        // in the child :
-          
-        struct sigaction SIGINT_action = {0}, ignore_action = {0};
-        sigaction(SIGINT, &SIGINT_action, NULL);
-        
-        // block the SIGTSTP
-        sigprocmask(SIG_BLOCK, &signal_set_ch, NULL);
-
-        // if running in background process, and if not on foreground only mode, child should ignore SIGINT
-        if (isBg && !fgOnlyMode) {
-          ignore_action.sa_handler = SIG_IGN;
-          sigaction(SIGINT, &ignore_action, NULL);
-        }
-        
-        // set the input / output redirections if requested
-        if (hasInpRed) {
-          if((fd_i = open(inputFile, O_RDONLY, 00600)) < 0) {
-            fprintf(stdout,"cannot open %s for input\n", inputFile);
-            exit(1);
-          } else {
-            if (dup2(fd_i, 0) < 0) {
-              perror("Input file dup2"); 
-              exit(1);
-            }
-          }
-        }
-        if (hasOutRed) {
-          if((fd_o = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, 00600)) < 0) {
-            fprintf(stdout,"cannot open %s for output\n", outputFile);
-            exit(1);
-          } else {
-            if(dup2(fd_o, 1) < 0) {
-              perror("Output file dup2"); 
-              exit(1);
-            }
-          }
-        }
-
-        // execute non built in commands in the child process
-        if (execvp(enteredargs[0], enteredargs)){
-          perror(enteredargs[0]);   
-          exit(1);          
-        }
-
-        // close the file descriptors if opened
-        if (hasInpRed) {
-          if(close(fd_i) < 0) {
-            perror("Input file");
-            exit(1);
-          }
-        }
-        if (hasOutRed) {
-          if(close(fd_o) < 0) {
-            perror("Output file");
-            exit(1);
-          } 
-        }
-        
-        // exit the child process
-        exit(0);
-      
-      } else {
-        // in the parent:
-
-        // block SIGTSTP signal while child process is running - background will not be affected as the parent will run in parallel
-        sigprocmask(SIG_BLOCK, &signal_set_ch, NULL);
-        
-        // check whether bg or fg  if bg, WNOHANG is used
-        if (isBg && !fgOnlyMode) {
-          
-          // this is for the background process - store shild pids in an array for following their status, and further use
-          childPids[childNo] = spawnPid;
-
-          // move childNo to the next empty spot in the childPids array - ensured earlier that there is an extra empty spot
-          do {
-            childNo++;
-            if (childNo == 101) {childNo = 0;}     
-          } while (childPids[childNo] != 0); 
-
-          // print the pid of the new initiated background process 
-          printf("background pid is %d\n",spawnPid);
-          fflush(stdout);
-
-          // use NOHANG for background process not to block parent
-          spawnPid = waitpid(spawnPid, &childStatus, WNOHANG);
-        
-        } else {
-          
-          // this is for the foreground process - set status to exit/termination status
-          spawnPid = waitpid(spawnPid, &childStatus, 0);
-
-          if (WIFEXITED(childStatus)) {
-            lastStatusType = 0;
-            lastStatus = WEXITSTATUS(childStatus);
-          } else { 
-            lastStatus = WTERMSIG(childStatus);
-            lastStatusType = 1;
-            char lSstr [1];
-            sprintf(lSstr, "%d", lastStatus);
-            
-            write(1,"terminated by signal ",22);
-            write(1, lSstr, 1);
-            write(1, "\n", 1);
-          } 
-        }
-        
-        // unblock SIGTSTP, foreground process stopps here (background child reaches here immediately, parent unaffected from background)
-        sigprocmask(SIG_UNBLOCK, &signal_set_ch, NULL);
-
-      } // closing paranthesis for else statement (related to parent process)
-    }   // closing paranthesis for else statement (related to non built-in command actions)
-  }     // closing paranthesis for while loop
-}      
+// Author:      Serkan Bayramoglu
+// Email:       bayramos@oregonstate.edu
+// Date:        July 24, 2022
+// Description: This project provides a small shell to the user. The program has 3 built in functions; cd for changing 
+//              the working directory, status for providing the exit value of the termination signal number of the most recent 
+//              background process, and  exit for exiting the proram. The program uses execvp() to execute all other command 
+//              line commands using child processes. The program allows for a maximum length of 2048 characters consisting of 
+//              a maximum of 512 arguments (incl. input / output redirections and background processing symbols, and the 
+//              commands. The character '<' stands for input redirection, '>' for output redirection, and '&' (if at the end) 
+//              for background processing. the '<' and '>' characters can be in any order, each followed by their respective 
+//              file names,before & (if there is any background processing request), however, after all other arguments. 
+//              Otherwise they are considered as ordinary strings to be used as arguments for the previous commands. The 
+//              program allows for consecutive spaces before, in between or after the arguments, which are not taken into 
+//              consideration. However, there must be at least one space between each argument. Built in commands cannot run 
+//              on background. Any command ending with & (other than the built in commands) will run at the background while 
+//              the rest run on the foreground. There is no limit on the number of background jobs, unless a cap is set with 
+//              jobcap, in which case the new jobs are queued, rejected or wait for a running one to end. For redirection 
+//              of standard input and / or output. The dup2() function is used in the program. Spaces inside arguments are not 
+//              allowed, and quoting is not supported. The '|' operator connects commands into a pipeline, where each stage
+//              reads the output of the previous one through a pipe, and only the last stage sets the status. The program does not take 
+//              into consideration the blank lines when entered, and any lines that start with '#' character. '$$' is the 
+//              expansion string, which is replaced by the program with the pid number of the parent process. The SIGINT signal
+//              is ignored by the parent process and any background processes. However, when received by the foreground child
+//              process, the child process kills itself, and afterwards the parent process prints out the number of the signal
+//              that killed the foreground child process before prompting the user for the next input. All foreground and 
+//              background processes ignore the SIGSTP signal, while the parent, each time received while the parent is active, 
+//              the shell switches alternatively between normal mode and foregrounf mode. When the shell is in the foreground
+//              mode, even the user entries ending with '&' are processed in the foreground, and no new background process is 
+//              accepted.  
+
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+// Constants
+#define MAX_LEN 2048
+#define MAX_ARG 512
+#define INPUT_BUFFER 65536
+#define SUBST_MAX 1048576         // largest output of a $(...) command substitution
+#define RELAY_CHUNK 1048576       // most bytes moved at once by the relay of a >| redirection
+
+// Whether commands are started with posix_spawn() (1) or fork() (0) by default, can be changed with set -o / +o spawn
+#ifndef SPAWN_DEFAULT
+#define SPAWN_DEFAULT 1
+#endif
+
+// Whether the zygote helper starts the commands by default, can be changed with set -o / +o zygote
+#ifndef ZYGOTE_DEFAULT
+#define ZYGOTE_DEFAULT 0
+#endif
+
+// Global variables to be used by both, the event loop and main, and make all communicate
+int fgOnlyMode;
+int signalFd = -1;                // SIGCHLD and SIGTSTP are blocked and read from this signalfd
+int epollFd = -1;                 // waits on the input, signalFd and timerFd together
+int timerFd = -1;                 // timerfd armed for the earliest deadline of the timeout command
+int inputFd = 0;                  // stdin, or the script file, -1 for the command string of -c
+int inputPollable;                // 0 if the input cannot be watched by epoll (regular file), it is always ready then
+int interactive;                  // 1 if the commands are typed on a terminal, the prompt is only printed then
+
+// Messages of the events (jobs done, mode switches) collected to be written at once before the next prompt
+char *notices;
+size_t noticeLength, noticeCapacity;
+
+// Input buffer, filled with large reads and split into lines in place, or the command string of -c
+char inputBuffer[INPUT_BUFFER];
+char *inputData = inputBuffer;
+size_t inputStart, inputEnd;
+int inputEof;
+int inputSkipping;                // 1 while skipping the rest of a line longer than MAX_LEN
+
+int spawnMode = SPAWN_DEFAULT;    // 1 to start the commands with posix_spawn(), 0 with fork()
+int pipeSize;                     // size set on the pipes between the stages of a pipeline, 0 for the kernel default
+int lastStatusType = 0;           // 0 if exit, 1 if terminated, to be used by the status command
+int lastStatus = 0;
+int errExit;                      // 1 to exit the shell when a foreground command fails (set -e)
+
+// Zygote helper: a small process running the program of the shell again from the start, as smallsh --zygote with its
+// socket on ZYGOTE_SOCKET, which creates the children of the commands on request over the socket instead of the shell
+#define ZYGOTE_SOCKET 3
+int zygoteMode = ZYGOTE_DEFAULT;
+int zygoteFd = -1;                // the end of the socket of the shell, -1 if the helper is not running
+pid_t zygotePid;
+
+// Request to the zygote helper, sent with the stdin, stdout and stderr of the child, and followed by length bytes of 
+// words: the working directory, the command path, the arguments and the environment
+struct zygoteRequest {
+  int isBg;
+  pid_t pgid;
+  int argc;
+  int envc;
+  size_t length;
+};
+
+int historyMode;                  // 1 to record the lines entered in the history, on by default on a terminal
+
+// Options of the shell switched on and off with the set built in command, by name or by letter if they have one
+struct shellOption {
+  const char *name;
+  char letter;
+  int *value;
+};
+
+struct shellOption shellOptions[] = {
+  {"errexit", 'e', &errExit},
+  {"spawn", 0, &spawnMode},
+  {"zygote", 0, &zygoteMode},
+  {"history", 0, &historyMode},
+  {NULL, 0, NULL}
+};
+
+// Entry of the command path cache, a chain of entries is kept in each bucket of pathCache
+struct pathEntry {
+  char *name;
+  char *path;
+  unsigned long hits;
+  struct pathEntry *next;
+};
+
+#define PATH_BUCKETS 128
+struct pathEntry *pathCache[PATH_BUCKETS];
+char *pathCacheKey;               // the value of PATH the cached paths were resolved with
+int pathHasRelative;              // 1 if PATH has a relative (or empty) directory, which cd makes stale
+unsigned long pathHits, pathMisses;
+
+// Listing of a directory for the file name patterns, kept until the modification time of the directory changes, in 
+// the slot of its device and inode number
+struct dirListing {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int racy;                       // 1 if the directory changed just before it was read, the listing is read again
+  int count;
+  char **names;                   // sorted, pointing into data
+  int namesCapacity;
+  char *data;
+  size_t dataCapacity;
+};
+
+#define DIR_CACHE 64
+struct dirListing dirCache[DIR_CACHE];
+
+// Latency statistics of a command name, from its start until it is reaped, always collected and shown by stats. 
+// Bucket b counts the latencies from 2^b up to 2^(b+1) microseconds.
+#define LATENCY_BUCKETS 40
+struct commandStats {
+  char *name;
+  unsigned long count;
+  unsigned long long totalUs, maxUs;
+  unsigned long buckets[LATENCY_BUCKETS];
+  struct commandStats *next;
+};
+
+#define STATS_BUCKETS 256
+struct commandStats *statsTable[STATS_BUCKETS];
+
+// Resources used by the children of a command run with time in front of it, summed up as they are reaped
+int timing;
+struct rusage timedUsage;
+struct timespec timedStart;
+
+// Trace of the execution in the Chrome Trace Event format (a JSON array of events, for chrome://tracing or Perfetto),
+// written while tracing is on, with trace on FILE or the SMALLSH_TRACE variable. The events are collected in 
+// traceBuffer and written once it is nearly full, and the forked children send the time of their exec() on tracePipe.
+#define TRACE_BUFFER 65536
+int traceFd = -1;                 // the trace file, -1 while tracing is off
+char *traceName;
+char *traceBuffer;
+size_t traceLength;
+int traceCount;                   // events in the file so far, to put the commas between them
+pid_t tracePid;                   // pid of the shell, the pid of all the events and the thread of its own ones
+int tracePipe[2] = {-1, -1};      // made at the first trace on, and kept
+
+// What a forked child sends on tracePipe just before its exec()
+struct traceExec {
+  pid_t pid;
+  long long ns;
+};
+
+// One command of a pipeline with its arguments, and its redirections (NULL if not redirected)
+struct stage {
+  char **args;
+  char *inputFile;
+  char *outputFile;
+  char **outputFiles;             // the files of a >| redirection, NULL terminated, NULL if none
+};
+
+// One item of the parallel built in command, from its start until its status is reported
+struct parallelItem {
+  char *arg;                      // the argument put in the place of {} in the command
+  char *name;                     // name of the command run for it, for the latency statistics
+  pid_t pid;                      // 0 until started, -1 once reaped
+  int status;                     // wait status once reaped
+  int outFd;                      // with -k, read end of the pipe of its output, -1 once at its end
+  char *output;                   // with -k, the output kept until the items before it are reported
+  size_t outputLength, outputCapacity;
+  struct timespec started;
+};
+
+// A parsed command line: the stages of its pipeline, and whether it runs in the background
+struct command {
+  struct stage *stages;
+  int stageCount;
+  int isBg;
+};
+
+// Arena of the current line: the words and arrays parsed from a line are allocated by moving forward in a block, 
+// and all released at once before the next line. The blocks are kept and reused, for the memory use to stay flat.
+struct arenaBlock {
+  struct arenaBlock *next;
+  size_t size;
+  char data[];
+};
+
+#define ARENA_BLOCK 65536
+struct arenaBlock *arenaHead;     // first block, the others are chained after it
+struct arenaBlock *arenaBlock;    // block in use
+size_t arenaUsed;                 // bytes used in arenaBlock
+size_t arenaMark;                 // start of the word being built in arenaBlock
+
+// Output of the last $(...) command substitution, grown as needed up to SUBST_MAX
+char *captureBuffer;
+size_t captureCapacity;
+
+// Values of $$, $? and $! as strings, made again only when the value they were made from changes
+char mainpidstr[16];              // pid of the shell, made once
+size_t mainpidLength;
+char statusString[16];            // the status, as the exit value of the shell would give it
+int statusStringValue = -1;
+pid_t lastBgPid;                  // last pipe of the last background job started, 0 if none
+char bgPidString[16];
+pid_t bgPidStringPid;
+
+// A background job, the children of a background pipeline, followed until all of them are reaped
+struct job {
+  int id;                         // job number used as %n, 0 while the slot is on the free list
+  pid_t pgid;                     // process group of the pipeline, for kill %n
+  pid_t lastPid;                  // the last stage, which gives the exit value / termination signal of the job
+  int liveCount;                  // children not reaped yet
+  int status;                     // wait status of the last stage, once reaped
+  char *command;                  // the command line, for the jobs listing
+  pid_t *pids;                    // the children in the order of the stages, with the command names after them
+  char **names;
+  int pidCount;
+  struct timespec started;        // start of the job, for the latency statistics
+  unsigned int serial;            // unique number of the job, as its slot and job number are reused
+  int cpu;                        // CPU or NUMA node the job is pinned on by the placement policy, -1 if not pinned
+  int node;
+  int nextFree;                   // next slot on the free list
+};
+
+// Job table: the slots grow as needed and freed slots are reused through the free list, job %n is in jobs[n - 1]
+struct job *jobs;
+int jobSlots;
+int jobFree = -1;
+int jobCount;                     // number of jobs running
+int lastDoneStatus = -1;          // wait status of the last background job done, -1 if none since it was reset
+
+// Map from the pid of every background child to its job slot, open addressing with a power of two size
+pid_t *pidKeys;
+int *pidSlots;
+int pidTableSize;
+int pidTableUsed;
+
+// Time limit of a command run with timeout: the signal sent after duration, and SIGKILL grace later if grace is not 0,
+// the times in nanoseconds
+struct timeoutSpec {
+  long long duration;
+  int signal;
+  long long grace;
+};
+
+// Deadline of a command run with timeout, on the background job in slot (if its serial is still the same), or on the 
+// foreground children (slot -1, as long as fgSerial is the same). The deadlines are kept in a binary heap ordered by 
+// their time, a single timerfd being armed for the earliest one.
+struct deadline {
+  long long when;                 // CLOCK_MONOTONIC time in nanoseconds
+  int slot;
+  unsigned int serial;
+  int signal;
+  long long grace;                // time until SIGKILL after the signal, 0 for none
+};
+
+struct deadline *deadlines;
+int deadlineCount, deadlineCapacity;
+unsigned int jobSerial;           // serial of the last job started
+unsigned int fgSerial;            // serial of the foreground command, changed when it is done
+pid_t *fgPids;                    // the children of the foreground command while it is waited for, 0 once reaped
+int fgCount;
+
+// A background job waiting to be started, when the job cap is reached under the queue policy
+struct queuedJob {
+  struct stage *stages;
+  int stageCount;
+  char *command;
+  struct timeoutSpec limit;
+  struct queuedJob *next;
+};
+
+// What to do with a new background job when jobCap jobs are running already (0 for no cap)
+#define POLICY_QUEUE 0
+#define POLICY_REJECT 1
+#define POLICY_BLOCK 2
+const char *policyNames[] = {"queue", "reject", "block"};
+int jobCap;
+int jobPolicy = POLICY_QUEUE;
+struct queuedJob *queueHead, *queueTail;
+
+// Placement of the background jobs, set with the sched built in command: pinned on the next CPU in turn 
+// (round-robin), on the first CPU with the fewest jobs (pack), or on all the CPUs of the next NUMA node in turn (numa)
+#define PLACE_NONE 0
+#define PLACE_ROUND_ROBIN 1
+#define PLACE_PACK 2
+#define PLACE_NUMA 3
+#define MAX_NODES 64
+const char *placeNames[] = {"none", "round-robin", "pack", "numa"};
+int placePolicy = PLACE_NONE;
+int placeNext;                    // position of the next CPU or node under round-robin and numa
+int bgNice;                       // added to the nice value of the background jobs
+int bgNiceValue;                  // nice value of the background job being started, the one of the shell plus bgNice
+int bgBatch;                      // 1 to run the background jobs under SCHED_BATCH
+
+// CPUs the shell may run on and their NUMA nodes, read from the affinity of the shell and /sys on the first placement
+int cpuCount;                     // 0 until read
+int cpuList[CPU_SETSIZE];
+int cpuNode[CPU_SETSIZE];         // node of each CPU, by CPU number
+int cpuJobs[CPU_SETSIZE];         // running jobs pinned on each CPU, by CPU number
+int nodeCount;
+int nodeList[MAX_NODES];
+cpu_set_t nodeCpus[MAX_NODES];    // the CPUs of each node in nodeList the shell may run on
+cpu_set_t *placeSet;              // CPUs of the background job being started, NULL if it is not pinned
+
+
+// Adds a message to the notices, to be written out together with the next prompt
+void notice(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if (noticeLength + length + 2 > noticeCapacity) {
+    noticeCapacity = (noticeLength + length + 2) * 2;
+    notices = realloc(notices, noticeCapacity);
+  }
+  va_start(args, format);
+  vsnprintf(notices + noticeLength, length + 1, format, args);
+  va_end(args);
+  noticeLength += length;
+}
+
+// Writes the collected notices, followed by the prompt if requested, with a single write
+void flushNotices(int withPrompt) {
+  if (withPrompt) {
+    notice(":");
+  }
+  if (noticeLength > 0) {
+    fflush(stdout);
+    write(1, notices, noticeLength);
+    noticeLength = 0;
+  }
+}
+
+// Switches to and from the foreground only mode, when SIGTSTP is received
+void toggleFgOnlyMode(void) {
+  if (fgOnlyMode) {
+    notice("\nExiting foreground-only mode\n");
+    fgOnlyMode = 0;
+  } else {
+    notice("\nEntering foreground-only mode (& is now ignored)\n");
+    fgOnlyMode = 1;
+  }
+}
+
+
+// Strips the "< input_file" and "> output_file" pairs from the end of the arguments of a pipeline stage, in either 
+// order, and returns the number of remaining arguments. A ">| file ..." takes all the words after it, and can be 
+// preceded by "< input_file". The command itself is never taken as a redirection.
+int stripRedirections(struct stage *st, int argCount) {
+  st->inputFile = NULL;
+  st->outputFile = NULL;
+  st->outputFiles = NULL;
+  for (int k = 1; k < argCount - 1; k++) {
+    if (strcmp(st->args[k], ">|") == 0) {
+      st->outputFiles = &st->args[k + 1];
+      st->args[k] = NULL;
+      argCount = k;
+      break;
+    }
+  }
+  for (int pass = 0; pass < 2 && argCount > 2; pass++) {
+    if (!st->inputFile && strcmp(st->args[argCount - 2], "<") == 0) {
+      st->inputFile = st->args[argCount - 1];
+    } else if (!st->outputFile && strcmp(st->args[argCount - 2], ">") == 0) {
+      st->outputFile = st->args[argCount - 1];
+    } else {
+      break;
+    }
+    st->args[argCount - 2] = NULL;
+    argCount -= 2;
+  }
+  return argCount;
+}
+
+// Releases everything allocated in the arena for the previous line
+void arenaReset(void) {
+  arenaBlock = arenaHead;
+  arenaUsed = 0;
+  arenaMark = 0;
+}
+
+// Makes sure there are more free bytes after the used part of the block in use. If there are not, the next block 
+// (reused, or allocated large enough) is taken and the word being built since arenaMark is moved along to it. A new
+// block is twice as large as needed, for a word growing by small parts to move a number of times that is only
+// logarithmic in its size, and the blocks it leaves behind to add up to less than twice that size.
+void arenaReserve(size_t more) {
+  if (arenaBlock && arenaUsed + more <= arenaBlock->size) {
+    return;
+  }
+  size_t partial = arenaBlock ? arenaUsed - arenaMark : 0;
+  struct arenaBlock *next = arenaBlock ? arenaBlock->next : arenaHead;
+  if (!next || next->size < partial + more) {
+    size_t size = (partial + more > ARENA_BLOCK / 2) ? (partial + more) * 2 : ARENA_BLOCK;
+    struct arenaBlock *fresh = malloc(sizeof(struct arenaBlock) + size);
+    if (!fresh) {
+      perror("malloc");
+      exit(1);
+    }
+    fresh->size = size;
+    fresh->next = next;
+    if (arenaBlock) {
+      arenaBlock->next = fresh;
+    } else {
+      arenaHead = fresh;
+    }
+    next = fresh;
+  }
+  if (partial > 0) {
+    memcpy(next->data, arenaBlock->data + arenaMark, partial);
+  }
+  arenaBlock = next;
+  arenaMark = 0;
+  arenaUsed = partial;
+}
+
+// Allocates size bytes, aligned for pointers, from the arena
+void *arenaAlloc(size_t size) {
+  arenaUsed = (arenaUsed + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  arenaMark = arenaUsed;
+  arenaReserve(size);
+  void *memory = arenaBlock->data + arenaUsed;
+  arenaUsed += size;
+  arenaMark = arenaUsed;
+  return memory;
+}
+
+// Appends text to the word being built in the arena
+void arenaPut(const char *text, size_t length) {
+  arenaReserve(length);
+  memcpy(arenaBlock->data + arenaUsed, text, length);
+  arenaUsed += length;
+}
+
+// Terminates the word being built in the arena and returns it, the next word starts after it
+char *arenaEndWord(void) {
+  arenaPut("", 1);
+  char *word = arenaBlock->data + arenaMark;
+  arenaMark = arenaUsed;
+  return word;
+}
+
+// Position in the arena, to release what is allocated after it while keeping what was allocated before
+struct arenaPosition {
+  struct arenaBlock *block;
+  size_t used;
+};
+
+struct arenaPosition arenaSave(void) {
+  struct arenaPosition position = {arenaBlock, arenaUsed};
+  return position;
+}
+
+void arenaRestore(struct arenaPosition position) {
+  arenaBlock = position.block;
+  arenaUsed = position.used;
+  arenaMark = position.used;
+}
+
+ssize_t captureCommand(const char *text, size_t length);
+
+// End of the $(...) starting at text, after its matching ), or NULL if it is not closed
+const char *substitutionEnd(const char *text) {
+  int depth = 0;
+  const char *c = text + 1;
+  do {
+    if (*c == '(') {depth++;}
+    else if (*c == ')') {depth--;}
+    c++;
+  } while (depth > 0 && *c);
+  return depth > 0 ? NULL : c;
+}
+
+// Value of the variable name for the expansion, NULL if it is not set: $, ? and ! are the pid of the shell, the status
+// of the last command and the pid of the last background job, the others come from the environment
+const char *variableValue(const char *name) {
+  if (name[0] == '\0' || name[1] != '\0' || !strchr("$?!", name[0])) {
+    return getenv(name);
+  }
+  if (name[0] == '$') {
+    return mainpidstr;
+  }
+  if (name[0] == '?') {
+    int value = lastStatusType ? 128 + lastStatus : lastStatus;
+    if (value != statusStringValue) {
+      statusStringValue = value;
+      sprintf(statusString, "%d", value);
+    }
+    return statusString;
+  }
+  if (lastBgPid == 0) {
+    return NULL;
+  }
+  if (lastBgPid != bgPidStringPid) {
+    bgPidStringPid = lastBgPid;
+    sprintf(bgPidString, "%d", lastBgPid);
+  }
+  return bgPidString;
+}
+
+// Expands a word into out in the arena: each $NAME and ${NAME} is replaced with the value of the environment variable
+// NAME (nothing if it is not set), $$, $? and $! (or ${$}, ${?} and ${!}) with the pid of the shell, the status of the
+// last command (128 + the signal if it was terminated) and the pid of the last background job (nothing if none was
+// started), and each $(command) with the output of the command without its trailing newlines, split into words at 
+// the blanks. A $ that does not start one of them is kept as it is. Returns the number of words (0 if the word was 
+// only variables without a value or substitutions without output), or -1 (after a message) if there would be more
+// than room, or if a substitution failed.
+int expandWord(const char *word, char **out, int room) {
+  char name[MAX_LEN + 1];
+  const char *c = word;
+  int count = 0, started = 0;
+  while (*c) {
+    if (c[0] == '$' && c[1] == '(' && substitutionEnd(c)) {
+      const char *end = substitutionEnd(c);
+      // the part of the word built so far is put aside, the command allocates in the arena as well
+      char *prefix = started ? arenaEndWord() : "";
+      ssize_t length = captureCommand(c + 2, end - c - 3);
+      if (length < 0) {return -1;}
+      arenaPut(prefix, strlen(prefix));
+      for (ssize_t k = 0; k < length; ) {
+        if (captureBuffer[k] == ' ' || captureBuffer[k] == '\t' || captureBuffer[k] == '\n') {
+          if (started) {
+            if (count == room) {
+              write(2,"You exceeded the number of arguments. Please try again!\n",56); 
+              return -1;
+            }
+            out[count++] = arenaEndWord();
+            started = 0;
+          }
+          k++;
+          continue;
+        }
+        ssize_t span = 1;
+        while (k + span < length && !strchr(" \t\n", captureBuffer[k + span])) {span++;}
+        arenaPut(captureBuffer + k, span);
+        k += span;
+        started = 1;
+      }
+      c = end;
+      continue;
+    }
+    if (c[0] == '$' && c[1] && strchr("$?!", c[1])) {
+      name[0] = c[1];
+      name[1] = '\0';
+      c += 2;
+    } else if (c[0] == '$' && (isalpha((unsigned char)c[1]) || c[1] == '_')) {
+      size_t length = 1;
+      while (isalnum((unsigned char)c[length + 1]) || c[length + 1] == '_') {length++;}
+      memcpy(name, c + 1, length);
+      name[length] = '\0';
+      c += length + 1;
+    } else if (c[0] == '$' && c[1] == '{' && strchr(c + 2, '}')) {
+      size_t length = strchr(c + 2, '}') - (c + 2);
+      memcpy(name, c + 2, length);
+      name[length] = '\0';
+      c += length + 3;
+    } else {
+      size_t span = strcspn(c + 1, "$") + 1;
+      arenaPut(c, span);
+      c += span;
+      started = 1;
+      continue;
+    }
+    // a variable without a value adds nothing, and a word made only of such variables is dropped
+    const char *value = variableValue(name);
+    if (value && *value) {
+      arenaPut(value, strlen(value));
+      started = 1;
+    }
+  }
+  if (started) {
+    if (count == room) {
+      write(2,"You exceeded the number of arguments. Please try again!\n",56); 
+      return -1;
+    }
+    out[count++] = arenaEndWord();
+  }
+  return count;
+}
+
+// Whether the word has a * or ?, or a [ with a ] after it, to be expanded as a file name pattern
+int isPattern(const char *word) {
+  for (const char *c = word; *c; c++) {
+    if (*c == '*' || *c == '?') {return 1;}
+    if (*c == '[' && strchr(c + 1, ']')) {return 1;}
+  }
+  return 0;
+}
+
+// Matches one element of a pattern, a character, ? or a [...] set, against c. Returns the length of the element, 
+// negative if it does not match c.
+int matchElement(const char *p, char c) {
+  if (*p == '?') {return 1;}
+  if (*p != '[') {return *p == c ? 1 : -1;}
+
+  // in a set, ! or ^ first inverts it, a ] first is an ordinary character, and a-z is a range
+  const char *q = p + 1;
+  int invert = (*q == '!' || *q == '^');
+  if (invert) {q++;}
+  int found = 0;
+  const char *first = q;
+  while (*q && *q != '/' && (*q != ']' || q == first)) {
+    if (q[1] == '-' && q[2] && q[2] != ']' && q[2] != '/') {
+      if ((unsigned char)q[0] <= (unsigned char)c && (unsigned char)c <= (unsigned char)q[2]) {found = 1;}
+      q += 3;
+    } else {
+      if (*q == c) {found = 1;}
+      q++;
+    }
+  }
+  // a [ without its ] is an ordinary character
+  if (*q != ']') {return c == '[' ? 1 : -1;}
+  int length = q + 1 - p;
+  return (found != invert) ? length : -length;
+}
+
+// Whether the name matches one component of a pattern, up to its end or a /. Only the position after the last * 
+// is returned to when the rest does not match, which keeps the time linear in practice and never exponential.
+int globMatch(const char *pattern, const char *name) {
+  const char *p = pattern, *n = name;
+  const char *starP = NULL, *starN = NULL;
+  while (*n) {
+    if (*p == '*') {
+      starP = ++p;
+      starN = n;
+      continue;
+    }
+    if (*p && *p != '/') {
+      int length = matchElement(p, *n);
+      if (length > 0) {
+        p += length;
+        n++;
+        continue;
+      }
+    }
+    if (!starP) {return 0;}
+    p = starP;
+    n = ++starN;
+  }
+  while (*p == '*') {p++;}
+  return *p == '\0' || *p == '/';
+}
+
+int compareNames(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+// Sorted names of the directory, without . and .., read with readdir() once and kept in dirCache until its 
+// modification time changes. Returns NULL if the directory cannot be read.
+struct dirListing *listDirectory(const char *path) {
+  struct stat info;
+  if (stat(path, &info) < 0 || !S_ISDIR(info.st_mode)) {return NULL;}
+  struct dirListing *listing = &dirCache[(info.st_dev * 31 + info.st_ino) % DIR_CACHE];
+  if (listing->names && listing->dev == info.st_dev && listing->ino == info.st_ino && !listing->racy && 
+      listing->mtime.tv_sec == info.st_mtim.tv_sec && listing->mtime.tv_nsec == info.st_mtim.tv_nsec) {
+    return listing;
+  }
+
+  DIR *dir = opendir(path);
+  if (!dir) {return NULL;}
+  size_t used = 0;
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2]))) {
+      continue;
+    }
+    size_t length = strlen(entry->d_name) + 1;
+    if (used + length > listing->dataCapacity) {
+      listing->dataCapacity = (used + length) * 2;
+      listing->data = realloc(listing->data, listing->dataCapacity);
+    }
+    memcpy(listing->data + used, entry->d_name, length);
+    used += length;
+    count++;
+  }
+  closedir(dir);
+
+  // the names are pointed to once all of them are read, as the block can move while growing
+  if (count + 1 > listing->namesCapacity) {
+    listing->namesCapacity = (count + 1) * 2;
+    listing->names = realloc(listing->names, listing->namesCapacity * sizeof(char *));
+  }
+  char *name = listing->data;
+  for (int k = 0; k < count; k++) {
+    listing->names[k] = name;
+    name += strlen(name) + 1;
+  }
+  qsort(listing->names, count, sizeof(char *), compareNames);
+  listing->count = count;
+  listing->dev = info.st_dev;
+  listing->ino = info.st_ino;
+  listing->mtime = info.st_mtim;
+  // the time stamps of the files are coarse, a directory changed in the last seconds can change again with the same 
+  // modification time, its listing is not reused
+  listing->racy = (time(NULL) - info.st_mtim.tv_sec < 2);
+  return listing;
+}
+
+// Adds to out the paths matching the components of a pattern from component on, below the path built so far (of 
+// pathLength characters in path). Returns the new number of words in out, or -1 if there would be more than room.
+int globComponents(char *path, size_t pathLength, char **components, int component, int componentCount, 
+    int dirOnly, char **out, int count, int room) {
+  if (component == componentCount) {
+    struct stat info;
+    if (dirOnly && (stat(path, &info) < 0 || !S_ISDIR(info.st_mode))) {return count;}
+    if (count == room) {return -1;}
+    arenaPut(path, pathLength);
+    if (dirOnly) {arenaPut("/", 1);}
+    out[count++] = arenaEndWord();
+    return count;
+  }
+
+  char *pattern = components[component];
+  size_t length = strlen(pattern);
+  int separator = (pathLength > 0 && path[pathLength - 1] != '/');
+  if (pathLength + separator + length >= PATH_MAX) {return count;}
+  if (!isPattern(pattern)) {
+    // a component without a pattern only has to exist
+    if (separator) {path[pathLength] = '/';}
+    memcpy(path + pathLength + separator, pattern, length + 1);
+    struct stat info;
+    if (lstat(path, &info) < 0) {return count;}
+    return globComponents(path, pathLength + separator + length, components, component + 1, componentCount, 
+        dirOnly, out, count, room);
+  }
+
+  struct dirListing *listing = listDirectory(pathLength > 0 ? path : ".");
+  if (!listing) {return count;}
+  // the listing can be replaced in the cache by the directories below, the names of this one are copied first
+  int nameCount = listing->count;
+  char **names = listing->names;
+  if (component < componentCount - 1) {
+    names = arenaAlloc((nameCount + 1) * sizeof(char *));
+    int matches = 0;
+    for (int k = 0; k < listing->count; k++) {
+      if (globMatch(pattern, listing->names[k]) && (listing->names[k][0] != '.' || pattern[0] == '.')) {
+        arenaPut(listing->names[k], strlen(listing->names[k]));
+        names[matches++] = arenaEndWord();
+      }
+    }
+    nameCount = matches;
+  }
+  for (int k = 0; k < nameCount; k++) {
+    if (names == listing->names && (!globMatch(pattern, names[k]) || (names[k][0] == '.' && pattern[0] != '.'))) {
+      continue;
+    }
+    size_t nameLength = strlen(names[k]);
+    if (pathLength + separator + nameLength >= PATH_MAX) {continue;}
+    if (separator) {path[pathLength] = '/';}
+    memcpy(path + pathLength + separator, names[k], nameLength + 1);
+    count = globComponents(path, pathLength + separator + nameLength, components, component + 1, componentCount, 
+        dirOnly, out, count, room);
+    if (count < 0) {return -1;}
+  }
+  return count;
+}
+
+// Expands a file name pattern into out, sorted, or keeps it as it is if no file matches. Returns the number of words,
+// or -1 (after a message) if there would be more than room.
+int globWord(char *word, char **out, int room) {
+  char copy[PATH_MAX];
+  char path[PATH_MAX];
+  char *components[PATH_MAX / 2];
+  int componentCount = 0;
+  size_t length = strlen(word);
+  if (length >= PATH_MAX) {
+    out[0] = word;
+    return room > 0 ? 1 : -1;
+  }
+
+  // the pattern is split at the / into components, an absolute one starts from /, and a last / keeps directories only
+  memcpy(copy, word, length + 1);
+  size_t pathLength = 0;
+  if (copy[0] == '/') {path[pathLength++] = '/';}
+  path[pathLength] = '\0';
+  for (char *part = strtok(copy, "/"); part; part = strtok(NULL, "/")) {
+    components[componentCount++] = part;
+  }
+  int dirOnly = (length > 1 && word[length - 1] == '/');
+
+  int count = globComponents(path, pathLength, components, 0, componentCount, dirOnly, out, 0, room);
+  if (count < 0) {
+    fprintf(stderr, "%s: too many matches, the limit is %d arguments\n", word, MAX_ARG);
+    return -1;
+  }
+  if (count == 0) {
+    if (room == 0) {return -1;}
+    out[count++] = word;
+  }
+  return count;
+}
+
+// Expands one word: its variables and substitutions, then the file name patterns of the words it gave. Returns the
+// number of words in out, or -1 (after a message) if there would be more than room, or if the expansion failed.
+int expandArg(char *word, char **out, int room) {
+  int count;
+  if (strchr(word, '$')) {
+    count = expandWord(word, out, room);
+    if (count < 0) {return -1;}
+  } else {
+    if (room == 0) {
+      write(2,"You exceeded the number of arguments. Please try again!\n",56); 
+      return -1;
+    }
+    out[0] = word;
+    count = 1;
+  }
+
+  // the patterns are expanded from the last word on, for the words they give to take the place of the ones after
+  for (int k = count - 1; k >= 0; k--) {
+    if (!isPattern(out[k])) {continue;}
+    char *pattern = out[k];
+    int after = count - k - 1;
+    char **matches = arenaAlloc((room - k + 1) * sizeof(char *));
+    int matchCount = globWord(pattern, matches, room - k - after);
+    if (matchCount < 0) {return -1;}
+    memmove(out + k + matchCount, out + k + 1, after * sizeof(char *));
+    memcpy(out + k, matches, matchCount * sizeof(char *));
+    count += matchCount - 1;
+  }
+  return count;
+}
+
+// Expands a redirection file name, which has to stay one word
+char *expandFileName(char *file) {
+  char *words[2];
+  if (expandWord(file, words, 2) != 1) {
+    fprintf(stderr, "%s: ambiguous redirect\n", file);
+    return NULL;
+  }
+  return words[0];
+}
+
+// Expands the words of the stages that have a $ or a file name pattern, the others are kept as they are. The 
+// limits of the line, MAX_LEN characters and MAX_ARG words, apply to the expanded command. Returns 0, or -1 (after 
+// a message) if the command cannot be run.
+int expandStages(struct stage *stages, int stageCount) {
+  int expanded = 0;
+  for (int s = 0; s < stageCount; s++) {
+    char **arg = stages[s].args;
+    while (*arg && !strchr(*arg, '$') && !isPattern(*arg)) {arg++;}
+    if (*arg) {
+      // the words are copied to a new array, as a substitution or a pattern can give any number of words
+      char **args = arenaAlloc((MAX_ARG + 1) * sizeof(char *));
+      int count = 0;
+      for (arg = stages[s].args; *arg; arg++) {
+        if (!strchr(*arg, '$') && !isPattern(*arg)) {
+          args[count++] = *arg;
+          continue;
+        }
+        int words = expandArg(*arg, args + count, MAX_ARG - count);
+        if (words < 0) {return -1;}
+        count += words;
+      }
+      if (count == 0) {
+        write(2,"Missing command before or after |. Please try again!\n",53);
+        return -1;
+      }
+      args[count] = NULL;
+      stages[s].args = args;
+      expanded = 1;
+    }
+    if (stages[s].inputFile && strchr(stages[s].inputFile, '$')) {
+      if (!(stages[s].inputFile = expandFileName(stages[s].inputFile))) {return -1;}
+      expanded = 1;
+    }
+    if (stages[s].outputFile && strchr(stages[s].outputFile, '$')) {
+      if (!(stages[s].outputFile = expandFileName(stages[s].outputFile))) {return -1;}
+      expanded = 1;
+    }
+    char **file = stages[s].outputFiles;
+    while (file && *file && !strchr(*file, '$')) {file++;}
+    if (file && *file) {
+      // copied as well, each file giving one word
+      int count = 0;
+      while (stages[s].outputFiles[count]) {count++;}
+      char **files = arenaAlloc((count + 1) * sizeof(char *));
+      for (int k = 0; k <= count; k++) {
+        files[k] = stages[s].outputFiles[k];
+        if (files[k] && strchr(files[k], '$') && !(files[k] = expandFileName(files[k]))) {return -1;}
+      }
+      stages[s].outputFiles = files;
+      expanded = 1;
+    }
+  }
+  if (!expanded) {return 0;}
+
+  // only an expanded line can get over the limits, its words are counted and measured once
+  size_t length = 0;
+  int wordCount = stageCount - 1;
+  for (int s = 0; s < stageCount; s++) {
+    for (char **arg = stages[s].args; *arg; arg++) {
+      length += strlen(*arg) + 1;
+      wordCount++;
+    }
+    if (stages[s].inputFile) {
+      length += strlen(stages[s].inputFile) + 3;
+      wordCount += 2;
+    }
+    if (stages[s].outputFile) {
+      length += strlen(stages[s].outputFile) + 3;
+      wordCount += 2;
+    }
+    for (char **file = stages[s].outputFiles; file && *file; file++) {
+      length += strlen(*file) + 1;
+      wordCount++;
+    }
+    if (stages[s].outputFiles) {
+      length += 3;
+      wordCount++;
+    }
+  }
+  if (length > MAX_LEN) {
+    write(2,"You exceeded the command length. Please try again!\n",51); 
+    return -1;
+  }
+  if (wordCount > MAX_ARG) {
+    write(2,"You exceeded the number of arguments. Please try again!\n",56); 
+    return -1;
+  }
+  return 0;
+}
+
+// Parses a line in a single pass into cmd, with its words built in the arena and left as they are, the $ variables,
+// $(...) and file name patterns being expanded later by expandStages(). The words are split at each | into the 
+// stages of the pipeline, the trailing < and > redirections of each stage are taken out of its arguments, and a 
+// last & makes the command a background one. 
+// Returns 1 for a command, 0 for a blank or comment line, and -1 (after a message) if the line cannot be run.
+int parseLine(char *line, struct command *cmd) {
+  char **words = arenaAlloc((MAX_ARG + 1) * sizeof(char *));
+  int wordCount = 0;
+  int stageStart = 0;
+  char *c = line;
+
+  cmd->stages = arenaAlloc((MAX_ARG / 2 + 1) * sizeof(struct stage));
+  cmd->stageCount = 0;
+  cmd->isBg = 0;
+
+  while (1) {
+    // consecutive blank spaces are disregarded
+    while (*c == ' ') {c++;}
+    if (*c == '\0') {break;}
+
+    // a line that starts with # is a comment
+    if (wordCount == 0 && *c == '#') {
+      return 0;
+    }
+    if (wordCount == MAX_ARG) {
+      write(2,"You exceeded the number of arguments. Please try again!\n",56); 
+      return -1;
+    }
+
+    // a | alone closes the stage before it
+    if (c[0] == '|' && (c[1] == ' ' || c[1] == '\0')) {
+      if (wordCount == stageStart) {
+        write(2,"Missing command before or after |. Please try again!\n",53);
+        return -1;
+      }
+      words[wordCount] = NULL;
+      cmd->stages[cmd->stageCount].args = &words[stageStart];
+      stripRedirections(&cmd->stages[cmd->stageCount], wordCount - stageStart);
+      cmd->stageCount++;
+      stageStart = ++wordCount;
+      c++;
+      continue;
+    }
+
+    // copy the word into the arena, a $(...) is kept whole with its spaces, to be run when the command is expanded
+    while (*c != ' ' && *c != '\0') {
+      if (c[0] == '$' && c[1] == '(') {
+        char *end = (char *)substitutionEnd(c);
+        if (!end) {
+          write(2,"Missing ) after $(. Please try again!\n",38);
+          return -1;
+        }
+        arenaPut(c, end - c);
+        c = end;
+      } else {
+        size_t span = strcspn(c + 1, " $") + 1;
+        arenaPut(c, span);
+        c += span;
+      }
+    }
+    words[wordCount++] = arenaEndWord();
+  }
+
+  if (wordCount == 0) {
+    return 0;
+  }
+
+  // if the last argument is &, the command is a background one, & is taken out for exec()
+  if (wordCount - stageStart > 1 && strcmp(words[wordCount - 1], "&") == 0) {
+    cmd->isBg = 1;
+    wordCount--;
+  }
+  if (wordCount == stageStart) {
+    write(2,"Missing command before or after |. Please try again!\n",53);
+    return -1;
+  }
+  words[wordCount] = NULL;
+  cmd->stages[cmd->stageCount].args = &words[stageStart];
+  stripRedirections(&cmd->stages[cmd->stageCount], wordCount - stageStart);
+  cmd->stageCount++;
+  return 1;
+}
+
+// FNV-1a hash of a string, for the hash tables of the shell
+unsigned int hashString(const char *text) {
+  unsigned int hash = 2166136261u;
+  for (const char *c = text; *c; c++) {
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  }
+  return hash;
+}
+
+// Microseconds elapsed since start
+unsigned long long elapsedUs(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000ULL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Adds a latency to the statistics of a command name
+void recordLatency(const char *name, unsigned long long us) {
+  unsigned int hash = hashString(name) % STATS_BUCKETS;
+  struct commandStats *entry = statsTable[hash];
+  while (entry && strcmp(entry->name, name) != 0) {
+    entry = entry->next;
+  }
+  if (!entry) {
+    entry = calloc(1, sizeof(struct commandStats));
+    entry->name = strdup(name);
+    entry->next = statsTable[hash];
+    statsTable[hash] = entry;
+  }
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && (us >> (bucket + 1)) != 0) {
+    bucket++;
+  }
+  entry->buckets[bucket]++;
+  entry->count++;
+  entry->totalUs += us;
+  if (us > entry->maxUs) {entry->maxUs = us;}
+}
+
+// Upper bound of the bucket holding the given fraction of the latencies of a command, at most its maximum
+unsigned long long latencyPercentile(struct commandStats *entry, double fraction) {
+  unsigned long long wanted = (unsigned long long)(entry->count * fraction + 0.999999);
+  unsigned long long seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += entry->buckets[b];
+    if (seen >= wanted) {
+      unsigned long long bound = 2ULL << b;
+      return bound < entry->maxUs ? bound : entry->maxUs;
+    }
+  }
+  return entry->maxUs;
+}
+
+int compareStats(const void *a, const void *b) {
+  return strcmp((*(struct commandStats **)a)->name, (*(struct commandStats **)b)->name);
+}
+
+// Prints the latency statistics of every command sorted by name, as a table or as JSON for scripts, times in 
+// microseconds
+void printStats(int json) {
+  int count = 0;
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    for (struct commandStats *entry = statsTable[b]; entry; entry = entry->next) {count++;}
+  }
+  struct commandStats **sorted = malloc((count + 1) * sizeof(struct commandStats *));
+  count = 0;
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    for (struct commandStats *entry = statsTable[b]; entry; entry = entry->next) {sorted[count++] = entry;}
+  }
+  qsort(sorted, count, sizeof(struct commandStats *), compareStats);
+
+  if (!json) {
+    printf("%-20s %8s %10s %10s %10s %10s %10s\n", "command", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+  } else {
+    printf("[");
+  }
+  for (int i = 0; i < count; i++) {
+    struct commandStats *entry = sorted[i];
+    unsigned long long mean = entry->totalUs / entry->count;
+    if (!json) {
+      printf("%-20s %8lu %10llu %10llu %10llu %10llu %10llu\n", entry->name, entry->count, mean, 
+          latencyPercentile(entry, 0.5), latencyPercentile(entry, 0.9), latencyPercentile(entry, 0.99), entry->maxUs);
+      continue;
+    }
+    printf("%s\n  {\"command\": \"", i ? "," : "");
+    for (char *c = entry->name; *c; c++) {
+      if (*c == '"' || *c == '\\') {
+        printf("\\%c", *c);
+      } else if ((unsigned char)*c < 0x20) {
+        printf("\\u%04x", *c);
+      } else {
+        putchar(*c);
+      }
+    }
+    printf("\", \"count\": %lu, \"mean_us\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"max_us\": %llu}", 
+        entry->count, mean, latencyPercentile(entry, 0.5), latencyPercentile(entry, 0.9), 
+        latencyPercentile(entry, 0.99), entry->maxUs);
+  }
+  if (json) {
+    printf("%s]\n", count ? "\n" : "");
+  }
+  fflush(stdout);
+  free(sorted);
+}
+
+// Forgets the statistics of all the commands
+void resetStats() {
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    while (statsTable[b]) {
+      struct commandStats *entry = statsTable[b];
+      statsTable[b] = entry->next;
+      free(entry->name);
+      free(entry);
+    }
+  }
+}
+
+// Adds the resources used by a reaped child to the ones of the command run with time
+void addUsage(struct rusage *usage) {
+  if (!timing) {return;}
+  timeradd(&timedUsage.ru_utime, &usage->ru_utime, &timedUsage.ru_utime);
+  timeradd(&timedUsage.ru_stime, &usage->ru_stime, &timedUsage.ru_stime);
+  if (usage->ru_maxrss > timedUsage.ru_maxrss) {timedUsage.ru_maxrss = usage->ru_maxrss;}
+  timedUsage.ru_nvcsw += usage->ru_nvcsw;
+  timedUsage.ru_nivcsw += usage->ru_nivcsw;
+}
+
+// Prints what the command run with time used to stderr and stops the timing
+void reportTime(void) {
+  if (!timing) {return;}
+  unsigned long long us = elapsedUs(&timedStart);
+  char report[256];
+  int length = snprintf(report, sizeof(report), 
+      "real %llu.%03llus  user %ld.%03lds  sys %ld.%03lds  maxrss %ldKB  ctxsw %ld+%ld\n", 
+      us / 1000000, us / 1000 % 1000, 
+      (long)timedUsage.ru_utime.tv_sec, (long)timedUsage.ru_utime.tv_usec / 1000, 
+      (long)timedUsage.ru_stime.tv_sec, (long)timedUsage.ru_stime.tv_usec / 1000, 
+      timedUsage.ru_maxrss, timedUsage.ru_nvcsw, timedUsage.ru_nivcsw);
+  write(2, report, length);
+  timing = 0;
+}
+
+// Drops all the cached command paths, the hit / miss counters are kept
+void clearPathCache(void) {
+  for (int b = 0; b < PATH_BUCKETS; b++) {
+    while (pathCache[b]) {
+      struct pathEntry *entry = pathCache[b];
+      pathCache[b] = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+    }
+  }
+}
+
+// Returns the full path of the command name searched in PATH, from the cache when it has been searched before, so 
+// that the child can call execv() without scanning PATH again. NULL is returned for names with a '/', which are 
+// used as they are, and for commands not found, which are left to execvp() to report.
+char *lookupCommand(const char *name) {
+  char *pathVar = getenv("PATH");
+  unsigned int hash;
+  char candidate[MAX_LEN + 2];
+  struct stat sb;
+
+  if (strchr(name, '/') || !pathVar) {
+    return NULL;
+  }
+
+  // PATH changed since the paths were cached, start over with the new value
+  if (!pathCacheKey || strcmp(pathCacheKey, pathVar) != 0) {
+    clearPathCache();
+    free(pathCacheKey);
+    pathCacheKey = strdup(pathVar);
+    pathHasRelative = 0;
+    for (const char *dir = pathVar; dir; dir = strchr(dir, ':')) {
+      if (*dir == ':') {dir++;}
+      if (*dir != '/') {pathHasRelative = 1;}
+    }
+  }
+
+  hash = hashString(name);
+  for (struct pathEntry *entry = pathCache[hash % PATH_BUCKETS]; entry; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0) {
+      entry->hits++;
+      pathHits++;
+      return entry->path;
+    }
+  }
+  pathMisses++;
+
+  // search the directories of PATH in order, an empty directory stands for the working directory
+  const char *dir = pathVar;
+  while (1) {
+    const char *end = strchrnul(dir, ':');
+    int dirLen = end - dir;
+    if (dirLen + strlen(name) + 2 <= sizeof(candidate)) {
+      if (dirLen == 0) {
+        strcpy(candidate, name);
+      } else {
+        sprintf(candidate, "%.*s/%s", dirLen, dir, name);
+      }
+      if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) && access(candidate, X_OK) == 0) {
+        struct pathEntry *entry = malloc(sizeof(struct pathEntry));
+        entry->name = strdup(name);
+        entry->path = strdup(candidate);
+        entry->hits = 0;
+        entry->next = pathCache[hash % PATH_BUCKETS];
+        pathCache[hash % PATH_BUCKETS] = entry;
+        return entry->path;
+      }
+    }
+    if (*end == '\0') {break;}
+    dir = end + 1;
+  }
+  return NULL;
+}
+
+void applyPlacement(pid_t pid);
+
+// Moves length bytes from the pipe from to the file to with splice(), or only the bytes the pipe has (up to length) 
+// if exact is 0. Once copy is set, as it is when splice() does not support the file, the bytes go through buffer 
+// with read() and write() instead. If the file cannot be written (or to is -1), the bytes are taken out of the pipe 
+// all the same. Returns the number of bytes moved, 0 at the end of the input, or -1 if the file could not be written.
+ssize_t relayMove(int from, int to, size_t length, int exact, int *copy, char *buffer) {
+  size_t moved = 0;
+  int failed = to < 0 ? EBADF : 0;
+  while (moved < length) {
+    ssize_t bytes;
+    if (!*copy && !failed) {
+      bytes = splice(from, NULL, to, NULL, length - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (bytes < 0 && errno == EINVAL) {
+        *copy = 1;
+        continue;
+      }
+      if (bytes < 0 && errno != EINTR) {failed = errno;}
+      if (bytes < 0) {continue;}
+    } else {
+      bytes = read(from, buffer, length - moved < RELAY_CHUNK ? length - moved : RELAY_CHUNK);
+      if (bytes < 0 && errno == EINTR) {continue;}
+      if (bytes < 0) {break;}
+      for (ssize_t done = 0, written; !failed && done < bytes; done += written) {
+        written = write(to, buffer + done, bytes - done);
+        if (written < 0 && errno != EINTR) {failed = errno;}
+        if (written < 0) {written = 0;}
+      }
+    }
+    if (bytes == 0) {break;}
+    moved += bytes;
+    if (!exact) {break;}
+  }
+  if (failed) {
+    errno = failed;
+    return -1;
+  }
+  return moved;
+}
+
+// Relay of a >| redirection: copies what comes on the pipe in to all the files in fds until the end of the input. 
+// Each file but the last one gets a duplicate of the bytes waiting in the pipe with tee() into a pipe of its own, 
+// emptied into the file with splice(), then the bytes are spliced from the pipe to the last file, so that the data 
+// is never copied to user space unless splice() does not support a file. A file that cannot be written, or whose 
+// tee() is short or fails, is left out, and the relay stops when none is left.
+void relayOutput(int in, int *fds, char **files, int count) {
+  int spare[count][2];
+  int copy[count];
+  int teed[count];
+  char *buffer = malloc(RELAY_CHUNK);
+  int left = count;
+  int size = fcntl(in, F_GETPIPE_SZ);
+
+  for (int k = 0; k < count; k++) {
+    copy[k] = 0;
+    if (k < count - 1 && pipe2(spare[k], O_CLOEXEC) < 0) {
+      perror("pipe");
+      exit(1);
+    }
+    // as large as the input pipe, for a tee() to take all it has
+    if (k < count - 1 && size > 0) {fcntl(spare[k][1], F_SETPIPE_SZ, size);}
+  }
+
+  while (left > 0) {
+    ssize_t length;
+    if (count == 1) {
+      length = relayMove(in, fds[0], RELAY_CHUNK, 0, &copy[0], buffer);
+      if (length < 0) {
+        perror(files[0]);
+        fds[0] = -1;
+        left--;
+      }
+      if (length <= 0) {break;}
+      continue;
+    }
+
+    // the bytes waiting in the pipe are teed to the spare pipe of each file still written, the first copy giving 
+    // the length of this round, which every other copy has to have in full, the spare pipes being empty and as
+    // large as the input pipe
+    length = 0;
+    int ended = 0;
+    for (int k = 0; k < count - 1 && !ended; k++) {
+      ssize_t bytes;
+      teed[k] = 0;
+      if (fds[k] < 0) {continue;}
+      do {
+        bytes = tee(in, spare[k][1], length ? length : RELAY_CHUNK, 0);
+      } while (bytes < 0 && errno == EINTR);
+      if (length == 0 && bytes == 0) {
+        ended = 1;
+      } else if (bytes > 0 && (length == 0 || bytes == length)) {
+        length = bytes;
+        teed[k] = 1;
+      } else {
+        if (bytes >= 0) {errno = EIO;}
+        perror(files[k]);
+        fds[k] = -1;
+        left--;
+        int discard = 1;
+        if (bytes > 0) {relayMove(spare[k][0], -1, bytes, 1, &discard, buffer);}
+      }
+    }
+    if (ended) {break;}
+
+    for (int k = 0; k < count - 1; k++) {
+      if (teed[k] && relayMove(spare[k][0], fds[k], length, 1, &copy[k], buffer) < 0) {
+        perror(files[k]);
+        fds[k] = -1;
+        left--;
+      }
+    }
+    // the last file takes the bytes out of the input pipe, all it has if no other file is left
+    ssize_t moved = relayMove(in, fds[count - 1], length ? length : RELAY_CHUNK, length != 0, &copy[count - 1], 
+        buffer);
+    if (moved < 0 && fds[count - 1] >= 0) {
+      perror(files[count - 1]);
+      fds[count - 1] = -1;
+      left--;
+    }
+    if (moved == 0) {break;}
+  }
+  close(in);
+  free(buffer);
+}
+
+pid_t relayChild;                 // in the relay of a >| redirection, the child running the command
+
+// Sends a signal received by the relay of a >| redirection to the command, unless it came from the terminal, which
+// sends it to the command as well
+void forwardSignal(int sig, siginfo_t *info, void *context) {
+  if (info->si_code != SI_KERNEL) {
+    kill(relayChild, sig);
+  }
+}
+
+// Sets up a >| redirection in the forked child of a stage: the files are opened, then the command goes on in a new 
+// child with its stdout on a pipe, while this process relays the pipe to the files. The relay ends with the exit 
+// value or the termination signal of the command, for the shell to see them as the ones of the stage.
+void startRelay(struct stage *st, int isBg) {
+  int count = 0;
+  while (st->outputFiles[count]) {count++;}
+  int fds[count];
+  int pipeFds[2];
+  for (int k = 0; k < count; k++) {
+    if ((fds[k] = open(st->outputFiles[k], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600)) < 0) {
+      fprintf(stdout,"cannot open %s for output\n", st->outputFiles[k]);
+      exit(1);
+    }
+  }
+  if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  if (pipeSize > 0) {
+    fcntl(pipeFds[1], F_SETPIPE_SZ, pipeSize);
+  }
+  relayChild = fork();
+  if (relayChild < 0) {
+    perror("fork()");
+    exit(1);
+  }
+  if (relayChild == 0) {
+    if (dup2(pipeFds[1], 1) < 0) {
+      perror("Pipe dup2");
+      exit(1);
+    }
+    return;
+  }
+
+  // the relay keeps only the read end, the command has the write end and its other fds
+  close(pipeFds[1]);
+  close(0);
+  struct sigaction forward = {0};
+  forward.sa_sigaction = forwardSignal;
+  forward.sa_flags = SA_SIGINFO | SA_RESTART;
+  int forwarded[] = {SIGTERM, SIGHUP, SIGQUIT, SIGUSR1, SIGUSR2, SIGINT};
+  for (int k = 0; k < 6 - isBg; k++) {
+    sigaction(forwarded[k], &forward, NULL);
+  }
+  relayOutput(pipeFds[0], fds, st->outputFiles, count);
+
+  int childStatus;
+  while (waitpid(relayChild, &childStatus, 0) < 0 && errno == EINTR) {}
+  if (WIFSIGNALED(childStatus)) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, WTERMSIG(childStatus));
+    signal(WTERMSIG(childStatus), SIG_DFL);
+    sigprocmask(SIG_UNBLOCK, &signals, NULL);
+    raise(WTERMSIG(childStatus));
+    exit(128 + WTERMSIG(childStatus));
+  }
+  exit(WEXITSTATUS(childStatus));
+}
+
+// Sets up the forked child of a pipeline stage and executes its command, inFd and outFd are the pipe ends to be 
+// connected to its stdin and stdout (-1 if none), and pgid the process group of a background pipeline (0 to lead it)
+void execStage(struct stage *st, char *commandPath, int inFd, int outFd, int isBg, pid_t pgid) {
+  int fd_i, fd_o;
+  sigset_t signal_set_ch;
+  sigemptyset(&signal_set_ch);
+  sigaddset(&signal_set_ch, SIGTSTP);
+
+  struct sigaction SIGINT_action = {0}, ignore_action = {0};
+  sigaction(SIGINT, &SIGINT_action, NULL);
+  
+  // block the SIGTSTP only, SIGCHLD and SIGTSTP are blocked in the shell for its signalfd
+  sigprocmask(SIG_SETMASK, &signal_set_ch, NULL);
+
+  // if running in background process, child should ignore SIGINT and join the group of the pipeline
+  if (isBg) {
+    setpgid(0, pgid);
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore_action, NULL);
+    applyPlacement(0);
+  }
+
+  // connect the pipes from / to the neighbouring stages
+  if (inFd >= 0 && dup2(inFd, 0) < 0) {
+    perror("Pipe dup2");
+    exit(1);
+  }
+  if (outFd >= 0 && dup2(outFd, 1) < 0) {
+    perror("Pipe dup2");
+    exit(1);
+  }
+  
+  // set the input / output redirections if requested
+  if (st->inputFile) {
+    if((fd_i = open(st->inputFile, O_RDONLY, 00600)) < 0) {
+      fprintf(stdout,"cannot open %s for input\n", st->inputFile);
+      exit(1);
+    } else {
+      if (dup2(fd_i, 0) < 0) {
+        perror("Input file dup2"); 
+        exit(1);
+      }
+    }
+  }
+  if (st->outputFile) {
+    if((fd_o = open(st->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 00600)) < 0) {
+      fprintf(stdout,"cannot open %s for output\n", st->outputFile);
+      exit(1);
+    } else {
+      if(dup2(fd_o, 1) < 0) {
+        perror("Output file dup2"); 
+        exit(1);
+      }
+    }
+  }
+  if (st->outputFiles) {
+    startRelay(st, isBg);
+  }
+
+  // execute non built in commands in the child process, with a PATH search only if the path is not known, 
+  // or if the cached file is gone since
+  if (traceFd >= 0) {
+    struct traceExec record = {getpid(), 0};
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record.ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    write(tracePipe[1], &record, sizeof(record));
+  }
+  if (commandPath) {
+    execv(commandPath, st->args);
+  }
+  execvp(st->args[0], st->args);
+  perror(st->args[0]);   
+  exit(1);          
+}
+
+// Starts a pipeline stage with posix_spawn(), which lets the C library create the child without copying the page 
+// tables of the shell, with the same setup execStage() does in a forked child: SIGINT set back to default (or kept 
+// ignored in background), SIGTSTP blocked, the process group, and the pipes and redirections on stdin / stdout. 
+// Returns the pid of the child, or -1 if it could not be started, in which case the stage is forked instead for the 
+// child to report the error as usual.
+pid_t spawnStage(struct stage *st, char *commandPath, int inFd, int outFd, int isBg, pid_t pgid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t childMask, defaultSignals;
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  int fd_i = -1, fd_o = -1;
+  pid_t pid;
+  int err;
+
+  // the redirection files are opened here, close-on-exec, and dup'ed by the file actions
+  if (st->inputFile && (fd_i = open(st->inputFile, O_RDONLY | O_CLOEXEC)) < 0) {
+    return -1;
+  }
+  if (st->outputFile && (fd_o = open(st->outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600)) < 0) {
+    if (fd_i >= 0) {close(fd_i);}
+    return -1;
+  }
+  if (fd_i >= 0) {inFd = fd_i;}
+  if (fd_o >= 0) {outFd = fd_o;}
+
+  posix_spawn_file_actions_init(&actions);
+  if (inFd >= 0) {posix_spawn_file_actions_adddup2(&actions, inFd, 0);}
+  if (outFd >= 0) {posix_spawn_file_actions_adddup2(&actions, outFd, 1);}
+
+  sigemptyset(&childMask);
+  sigaddset(&childMask, SIGTSTP);
+  sigemptyset(&defaultSignals);
+  if (!isBg) {
+    sigaddset(&defaultSignals, SIGINT);
+  }
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &childMask);
+  posix_spawnattr_setsigdefault(&attr, &defaultSignals);
+  if (isBg) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, pgid);
+  }
+#ifdef POSIX_SPAWN_USEVFORK
+  flags |= POSIX_SPAWN_USEVFORK;
+#endif
+  posix_spawnattr_setflags(&attr, flags);
+
+  if (commandPath) {
+    err = posix_spawn(&pid, commandPath, &actions, &attr, st->args, environ);
+  } else {
+    err = posix_spawnp(&pid, st->args[0], &actions, &attr, st->args, environ);
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (fd_i >= 0) {close(fd_i);}
+  if (fd_o >= 0) {close(fd_o);}
+  return err ? -1 : pid;
+}
+
+// Reads exactly length bytes from fd, returns 0 on success and -1 at the end of the input or on an error
+int readFully(int fd, char *buffer, size_t length) {
+  while (length > 0) {
+    ssize_t bytes = read(fd, buffer, length);
+    if (bytes < 0 && errno == EINTR) {continue;}
+    if (bytes <= 0) {return -1;}
+    buffer += bytes;
+    length -= bytes;
+  }
+  return 0;
+}
+
+// Main loop of the zygote helper: for each request it creates the child with CLONE_PARENT, so that the child is a 
+// child of the shell, reaped and followed by the shell exactly as a forked one, and it replies with its pid (or 
+// -errno). It ends when the shell closes its end of the socket. It runs in a new image of the program, where nothing
+// of the shell is set up: the placement of the background jobs is left to the shell, with its current settings, and
+// the children of the helper are not traced.
+void zygoteLoop(int sock) {
+  char *data = NULL;
+  size_t dataCapacity = 0;
+
+  for (;;) {
+    struct zygoteRequest request;
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t bytes;
+    do {
+      bytes = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (bytes < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (bytes != sizeof(request) || !cmsg || cmsg->cmsg_type != SCM_RIGHTS || 
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+      exit(0);
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (request.length > dataCapacity) {
+      dataCapacity = request.length * 2;
+      data = realloc(data, dataCapacity);
+    }
+    if (readFully(sock, data, request.length) < 0) {
+      exit(0);
+    }
+
+    // the words are the cwd, the command path (empty if not known), then argc arguments and envc environment strings
+    char *words[request.argc + request.envc + 4];
+    char *word = data;
+    for (int w = 0; w < request.argc + request.envc + 2; w++) {
+      words[w] = word;
+      word += strlen(word) + 1;
+    }
+    char **args = words + 2;
+    char **env = args + request.argc + 1;
+    memmove(env, env - 1, request.envc * sizeof(char *));
+    args[request.argc] = NULL;
+    env[request.envc] = NULL;
+
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+    if (pid == 0) {
+      struct stage st = {args, NULL, NULL, NULL};
+      close(sock);
+      dup2(fds[2], 2);
+      if (chdir(words[0]) < 0) {
+        perror(words[0]);
+        exit(1);
+      }
+      environ = env;
+      execStage(&st, words[1][0] ? words[1] : NULL, fds[0], fds[1], request.isBg, request.pgid);
+    }
+    if (pid < 0) {
+      pid = -errno;
+    }
+    for (int f = 0; f < 3; f++) {close(fds[f]);}
+    send(sock, &pid, sizeof(pid), MSG_NOSIGNAL);
+  }
+}
+
+// Starts the zygote helper, which runs the program of the shell again, for it to stay as small as a shell at its 
+// start whenever it is started, with the signal mask and ignored signals of the shell kept through exec()
+void startZygote(void) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    perror("socketpair");
+    return;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork()");
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+  if (pid == 0) {
+    // the helper keeps only stdin / stdout / stderr and its socket, the other descriptors are close-on-exec
+    if (sv[1] == ZYGOTE_SOCKET) {
+      fcntl(sv[1], F_SETFD, 0);
+    } else {
+      dup2(sv[1], ZYGOTE_SOCKET);
+    }
+    execl("/proc/self/exe", "smallsh", "--zygote", (char *)NULL);
+    _exit(127);
+  }
+  close(sv[1]);
+  zygoteFd = sv[0];
+  zygotePid = pid;
+}
+
+// Stops the zygote helper, which ends when its socket is closed
+void stopZygote(void) {
+  if (zygoteFd < 0) {return;}
+  close(zygoteFd);
+  zygoteFd = -1;
+  waitpid(zygotePid, NULL, 0);
+}
+
+// Starts a pipeline stage through the zygote helper, with the redirections opened here and passed to it with the 
+// pipe ends and stderr, together with the arguments, the environment and the working directory of the shell. 
+// Returns the pid of the child, or -1 if it could not be started, in which case the stage is started without the 
+// helper, and the helper is stopped if it is gone.
+pid_t zygoteStage(struct stage *st, char *commandPath, int inFd, int outFd, int isBg, pid_t pgid) {
+  struct zygoteRequest request = {isBg, pgid, 0, 0, 0};
+  char cwd[4096];
+  int fd_i = -1, fd_o = -1;
+  pid_t pid = -1;
+
+  if (!getcwd(cwd, sizeof(cwd))) {return -1;}
+  if (st->inputFile && (fd_i = open(st->inputFile, O_RDONLY | O_CLOEXEC)) < 0) {
+    return -1;
+  }
+  if (st->outputFile && (fd_o = open(st->outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600)) < 0) {
+    if (fd_i >= 0) {close(fd_i);}
+    return -1;
+  }
+  int fds[3] = {fd_i >= 0 ? fd_i : (inFd >= 0 ? inFd : 0), fd_o >= 0 ? fd_o : (outFd >= 0 ? outFd : 1), 2};
+
+  // the request is followed by the words, each ending with a NUL
+  const char *path = commandPath ? commandPath : "";
+  size_t length = strlen(cwd) + strlen(path) + 2;
+  for (char **arg = st->args; *arg; arg++) {
+    length += strlen(*arg) + 1;
+    request.argc++;
+  }
+  for (char **env = environ; *env; env++) {
+    length += strlen(*env) + 1;
+    request.envc++;
+  }
+  request.length = length;
+  char *data = malloc(length);
+  char *end = stpcpy(data, cwd) + 1;
+  end = stpcpy(end, path) + 1;
+  for (char **arg = st->args; *arg; arg++) {end = stpcpy(end, *arg) + 1;}
+  for (char **env = environ; *env; env++) {end = stpcpy(end, *env) + 1;}
+
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = {&request, sizeof(request)};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent = sendmsg(zygoteFd, &msg, MSG_NOSIGNAL);
+  for (size_t done = 0; sent == sizeof(request) && done < length; done += sent) {
+    sent = send(zygoteFd, data + done, length - done, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {sent = 0;}
+    if (sent < 0) {break;}
+  }
+  if (sent >= 0 && readFully(zygoteFd, (char *)&pid, sizeof(pid)) < 0) {
+    sent = -1;
+  }
+  if (sent < 0) {
+    // the helper is gone, the commands are started by the shell from now on
+    stopZygote();
+    zygoteMode = 0;
+    pid = -1;
+  }
+
+  free(data);
+  if (fd_i >= 0) {close(fd_i);}
+  if (fd_o >= 0) {close(fd_o);}
+  return pid > 0 ? pid : -1;
+}
+
+long long monotonicNs(void);
+void traceEvent(const char *name, char phase, long long ns, pid_t tid, long long dur, const char *argName, 
+    const char *argText);
+void traceChild(pid_t pid, const char *name, long long forkNs, int execDone);
+void traceReap(pid_t pid, int childStatus);
+
+// Starts one child for each stage of the pipeline, the stdout of every stage is connected to the stdin of the next 
+// one with a pipe, and a file redirection of a stage takes over its end of the pipe. inFd and outFd, if not -1, are
+// given to the stdin of the first stage and the stdout of the last one, they are left open for the caller and have to
+// be close-on-exec. The pids of the children are stored in pids, and the number of children started is returned. 
+// The stages of a background pipeline share a process group of their own led by the first stage, while a foreground 
+// pipeline stays in the group of the shell for CTRL-C and CTRL-Z from the terminal to reach it.
+int runPipeline(struct stage *stages, int stageCount, int isBg, int inFd, int outFd, pid_t *pids) {
+  int prevRead = inFd;
+  int pipeFds[2];
+  pid_t pgid = 0;
+
+  if (isBg && bgNice) {
+    errno = 0;
+    int value = getpriority(PRIO_PROCESS, 0);
+    bgNiceValue = (errno == 0 ? value : 0) + bgNice;
+  }
+
+  for (int s = 0; s < stageCount; s++) {
+    // resolved in the parent, for the result to stay in the cache for the next commands
+    char *commandPath = lookupCommand(stages[s].args[0]);
+
+    pipeFds[0] = -1;
+    pipeFds[1] = -1;
+    if (s < stageCount - 1) {
+      // close-on-exec, so that the children only keep the ends dup'ed on their stdin / stdout
+      if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        if (prevRead >= 0 && prevRead != inFd) {close(prevRead);}
+        return s;
+      }
+      if (pipeSize > 0) {
+        fcntl(pipeFds[1], F_SETPIPE_SZ, pipeSize);
+      }
+    }
+    int stageOut = (s < stageCount - 1) ? pipeFds[1] : outFd;
+
+    // start the child through the zygote helper or with posix_spawn() if enabled, with fork() otherwise, or if they
+    // could not start it, a stage with a >| redirection is always forked for its child to become the relay
+    long long forkNs = traceFd >= 0 ? monotonicNs() : 0;
+    pid_t spawnPid = -1;
+    if (zygoteFd >= 0 && !stages[s].outputFiles) {
+      spawnPid = zygoteStage(&stages[s], commandPath, prevRead, stageOut, isBg, pgid);
+    }
+    if (spawnPid < 0 && spawnMode && !stages[s].outputFiles) {
+      spawnPid = spawnStage(&stages[s], commandPath, prevRead, stageOut, isBg, pgid);
+    }
+    // posix_spawn() returns once the child has called exec(), a forked child reports its exec() itself
+    int execDone = spawnPid > 0;
+    if (spawnPid < 0) {
+      spawnPid = fork();
+      if(spawnPid== -1) {
+        perror("fork()");
+        exit(1);
+      } else if (spawnPid == 0) {
+        execStage(&stages[s], commandPath, prevRead, stageOut, isBg, pgid);
+      }
+    }
+
+    // in the parent: set the group and the placement from this side as well, as the child may not have run yet, 
+    // or may have been started by posix_spawn() or the zygote helper
+    if (isBg) {
+      if (pgid == 0) {pgid = spawnPid;}
+      setpgid(spawnPid, pgid);
+      applyPlacement(spawnPid);
+    }
+    pids[s] = spawnPid;
+    if (forkNs) {
+      traceChild(spawnPid, stages[s].args[0], forkNs, execDone);
+    }
+
+    // the parent keeps only the read end of the new pipe, for the next stage
+    if (prevRead >= 0 && prevRead != inFd) {close(prevRead);}
+    if (pipeFds[1] >= 0) {close(pipeFds[1]);}
+    prevRead = pipeFds[0];
+  }
+  return stageCount;
+}
+
+// Slot of the pid in the pid map, or of the empty slot where it would go
+int pidIndex(pid_t pid) {
+  int i = ((unsigned int)pid * 2654435761u) & (pidTableSize - 1);
+  while (pidKeys[i] != 0 && pidKeys[i] != pid) {
+    i = (i + 1) & (pidTableSize - 1);
+  }
+  return i;
+}
+
+// Records the job slot of a background child, doubling the map when it gets half full
+void mapPid(pid_t pid, int slot) {
+  if ((pidTableUsed + 1) * 2 > pidTableSize) {
+    pid_t *oldKeys = pidKeys;
+    int *oldSlots = pidSlots;
+    int oldSize = pidTableSize;
+    pidTableSize = oldSize ? oldSize * 2 : 256;
+    pidKeys = calloc(pidTableSize, sizeof(pid_t));
+    pidSlots = malloc(pidTableSize * sizeof(int));
+    for (int i = 0; i < oldSize; i++) {
+      if (oldKeys[i] != 0) {
+        int j = pidIndex(oldKeys[i]);
+        pidKeys[j] = oldKeys[i];
+        pidSlots[j] = oldSlots[i];
+      }
+    }
+    free(oldKeys);
+    free(oldSlots);
+  }
+  int i = pidIndex(pid);
+  if (pidKeys[i] == 0) {pidTableUsed++;}
+  pidKeys[i] = pid;
+  pidSlots[i] = slot;
+}
+
+// Job slot of a background child, or -1 if the pid is not a background child
+int findPid(pid_t pid) {
+  if (pidTableSize == 0) {return -1;}
+  int i = pidIndex(pid);
+  return pidKeys[i] ? pidSlots[i] : -1;
+}
+
+// Removes a reaped child from the pid map, moving back the entries after it that would not be found otherwise
+void unmapPid(pid_t pid) {
+  int i = pidIndex(pid);
+  if (pidKeys[i] == 0) {return;}
+  pidKeys[i] = 0;
+  pidTableUsed--;
+  for (int j = (i + 1) & (pidTableSize - 1); pidKeys[j] != 0; j = (j + 1) & (pidTableSize - 1)) {
+    pid_t key = pidKeys[j];
+    int slot = pidSlots[j];
+    pidKeys[j] = 0;
+    int k = pidIndex(key);
+    pidKeys[k] = key;
+    pidSlots[k] = slot;
+  }
+}
+
+// Records the children of a background pipeline as a new job, in a free slot or in a new one, returns the slot
+int addJob(pid_t *pids, int pidCount, char *command, struct stage *stages, struct timespec *started) {
+  int slot;
+  if (jobFree >= 0) {
+    slot = jobFree;
+    jobFree = jobs[slot].nextFree;
+  } else {
+    if (jobSlots % 64 == 0) {
+      jobs = realloc(jobs, (jobSlots + 64) * sizeof(struct job));
+    }
+    slot = jobSlots++;
+  }
+  jobs[slot].id = slot + 1;
+  jobs[slot].pgid = pids[0];
+  jobs[slot].lastPid = pids[pidCount - 1];
+  jobs[slot].liveCount = pidCount;
+  jobs[slot].status = 0;
+  jobs[slot].command = command;
+  jobs[slot].started = *started;
+  jobs[slot].serial = ++jobSerial;
+  jobs[slot].cpu = -1;
+  jobs[slot].node = -1;
+
+  // the pids, the pointers to the names and the names are kept in one block
+  size_t size = pidCount * (sizeof(pid_t) + sizeof(char *));
+  for (int k = 0; k < pidCount; k++) {size += strlen(stages[k].args[0]) + 1;}
+  char **names = malloc(size);
+  pid_t *jobPids = (pid_t *)(names + pidCount);
+  char *name = (char *)(jobPids + pidCount);
+  for (int k = 0; k < pidCount; k++) {
+    jobPids[k] = pids[k];
+    names[k] = name;
+    name = stpcpy(name, stages[k].args[0]) + 1;
+    mapPid(pids[k], slot);
+  }
+  jobs[slot].pids = jobPids;
+  jobs[slot].pidCount = pidCount;
+  jobs[slot].names = names;
+  jobCount++;
+  return slot;
+}
+
+// Puts the slot of a finished job back on the free list
+void freeJob(int slot) {
+  if (jobs[slot].cpu >= 0) {cpuJobs[jobs[slot].cpu]--;}
+  free(jobs[slot].command);
+  free(jobs[slot].names);
+  jobs[slot].command = NULL;
+  jobs[slot].id = 0;
+  jobs[slot].nextFree = jobFree;
+  jobFree = slot;
+  jobCount--;
+}
+
+// Reads the CPUs the shell may run on, and the NUMA node of each of them from /sys/devices/system/node, all of 
+// them being on node 0 if it cannot be read
+void readTopology(void) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    cpuNode[cpu] = -1;
+    if (CPU_ISSET(cpu, &allowed)) {cpuList[cpuCount++] = cpu;}
+  }
+
+  DIR *dir = opendir("/sys/devices/system/node");
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    char path[300], list[4096];
+    int node;
+    if (sscanf(entry->d_name, "node%d", &node) != 1) {continue;}
+    snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {continue;}
+    ssize_t bytes = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (bytes <= 0) {continue;}
+    list[bytes] = '\0';
+
+    // the list is made of CPU numbers and ranges separated with commas, 0-3,8-11
+    for (char *item = list; *item >= '0' && *item <= '9'; ) {
+      long first = strtol(item, &item, 10), last = first;
+      if (*item == '-') {last = strtol(item + 1, &item, 10);}
+      for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {cpuNode[cpu] = node;}
+      if (*item == ',') {item++;}
+    }
+  }
+  if (dir) {closedir(dir);}
+
+  // the nodes in order, with the CPUs of the shell on each
+  for (int k = 0; k < cpuCount; k++) {
+    int node = cpuNode[cpuList[k]] >= 0 ? cpuNode[cpuList[k]] : 0;
+    int n = 0;
+    while (n < nodeCount && nodeList[n] != node) {n++;}
+    if (n == nodeCount && nodeCount == MAX_NODES) {
+      n = 0;
+    } else if (n == nodeCount) {
+      CPU_ZERO(&nodeCpus[n]);
+      nodeList[nodeCount++] = node;
+    }
+    cpuNode[cpuList[k]] = nodeList[n];
+    CPU_SET(cpuList[k], &nodeCpus[n]);
+  }
+}
+
+// Chooses where the next background job goes under the placement policy, filling set with its CPUs. The CPU or 
+// node is stored in cpu and node, -1 for what it is not pinned on.
+void choosePlacement(cpu_set_t *set, int *cpu, int *node) {
+  if (cpuCount == 0) {readTopology();}
+  *cpu = -1;
+  *node = -1;
+  if (placePolicy == PLACE_NUMA) {
+    int n = placeNext++ % nodeCount;
+    *node = nodeList[n];
+    *set = nodeCpus[n];
+    return;
+  }
+  if (placePolicy == PLACE_ROUND_ROBIN) {
+    *cpu = cpuList[placeNext++ % cpuCount];
+  } else {
+    // the lowest CPU among the least busy ones, so that the jobs stay on the first CPUs as long as they are free
+    *cpu = cpuList[0];
+    for (int k = 1; k < cpuCount; k++) {
+      if (cpuJobs[cpuList[k]] < cpuJobs[*cpu]) {*cpu = cpuList[k];}
+    }
+  }
+  CPU_ZERO(set);
+  CPU_SET(*cpu, set);
+}
+
+// Applies the placement of the background job being started to one of its children (pid 0 for the calling process):
+// its CPUs, and the nice value and SCHED_BATCH if set. Errors are ignored, the child may have ended already. The
+// values are absolute ones worked out by the shell, for the parent and the child to set the same whichever is last.
+void applyPlacement(pid_t pid) {
+  if (placeSet) {
+    sched_setaffinity(pid, sizeof(cpu_set_t), placeSet);
+  }
+  if (bgNice) {
+    setpriority(PRIO_PROCESS, pid, bgNiceValue);
+  }
+  if (bgBatch) {
+    struct sched_param param = {0};
+    sched_setscheduler(pid, SCHED_BATCH, &param);
+  }
+}
+
+// Describes the placement of a job, for the jobs listing and the start notice
+const char *describePlacement(int cpu, int node) {
+  static char text[32];
+  if (cpu >= 0) {
+    snprintf(text, sizeof(text), " on cpu %d", cpu);
+  } else if (node >= 0) {
+    snprintf(text, sizeof(text), " on node %d", node);
+  } else {
+    text[0] = '\0';
+  }
+  return text;
+}
+
+// Builds the command line of a pipeline back from its stages, for the jobs listing
+char *describeStages(struct stage *stages, int stageCount) {
+  size_t length = 1;
+  for (int s = 0; s < stageCount; s++) {
+    for (int k = 0; stages[s].args[k]; k++) {length += strlen(stages[s].args[k]) + 1;}
+    if (stages[s].inputFile) {length += strlen(stages[s].inputFile) + 3;}
+    if (stages[s].outputFile) {length += strlen(stages[s].outputFile) + 3;}
+    for (char **file = stages[s].outputFiles; file && *file; file++) {length += strlen(*file) + 4;}
+    length += 2;
+  }
+  char *command = malloc(length);
+  char *end = command;
+  for (int s = 0; s < stageCount; s++) {
+    if (s > 0) {end = stpcpy(end, "| ");}
+    for (int k = 0; stages[s].args[k]; k++) {
+      end = stpcpy(stpcpy(end, stages[s].args[k]), " ");
+    }
+    if (stages[s].inputFile) {end = stpcpy(stpcpy(stpcpy(end, "< "), stages[s].inputFile), " ");}
+    if (stages[s].outputFile) {end = stpcpy(stpcpy(stpcpy(end, "> "), stages[s].outputFile), " ");}
+    if (stages[s].outputFiles) {end = stpcpy(end, ">| ");}
+    for (char **file = stages[s].outputFiles; file && *file; file++) {end = stpcpy(stpcpy(end, *file), " ");}
+  }
+  if (end > command) {end--;}
+  *end = '\0';
+  return command;
+}
+
+// Copies the stages of a pipeline, for a queued job to outlive the input line
+struct stage *copyStages(struct stage *stages, int stageCount) {
+  struct stage *copy = malloc(stageCount * sizeof(struct stage));
+  for (int s = 0; s < stageCount; s++) {
+    int argCount = 0;
+    while (stages[s].args[argCount]) {argCount++;}
+    copy[s].args = malloc((argCount + 1) * sizeof(char *));
+    for (int k = 0; k <= argCount; k++) {
+      copy[s].args[k] = stages[s].args[k] ? strdup(stages[s].args[k]) : NULL;
+    }
+    copy[s].inputFile = stages[s].inputFile ? strdup(stages[s].inputFile) : NULL;
+    copy[s].outputFile = stages[s].outputFile ? strdup(stages[s].outputFile) : NULL;
+    copy[s].outputFiles = NULL;
+    if (stages[s].outputFiles) {
+      int count = 0;
+      while (stages[s].outputFiles[count]) {count++;}
+      copy[s].outputFiles = malloc((count + 1) * sizeof(char *));
+      for (int k = 0; k <= count; k++) {
+        copy[s].outputFiles[k] = stages[s].outputFiles[k] ? strdup(stages[s].outputFiles[k]) : NULL;
+      }
+    }
+  }
+  return copy;
+}
+
+void freeStages(struct stage *stages, int stageCount) {
+  for (int s = 0; s < stageCount; s++) {
+    for (int k = 0; stages[s].args[k]; k++) {free(stages[s].args[k]);}
+    free(stages[s].args);
+    free(stages[s].inputFile);
+    free(stages[s].outputFile);
+    for (char **file = stages[s].outputFiles; file && *file; file++) {free(*file);}
+    free(stages[s].outputFiles);
+  }
+  free(stages);
+}
+
+void setDeadline(struct timeoutSpec *limit, int slot);
+
+// Starts a background pipeline and records it as a job, the command is kept by the job, with its deadline if it has a 
+// time limit
+void startJob(struct stage *stages, int stageCount, char *command, struct timeoutSpec *limit) {
+  pid_t pids[stageCount];
+  struct timespec startTime;
+  cpu_set_t set;
+  int cpu = -1, node = -1;
+  if (placePolicy != PLACE_NONE) {
+    choosePlacement(&set, &cpu, &node);
+    placeSet = &set;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  int started = runPipeline(stages, stageCount, 1, -1, -1, pids);
+  placeSet = NULL;
+  if (started == 0) {
+    free(command);
+    return;
+  }
+  int slot = addJob(pids, started, command, stages, &startTime);
+  if (traceFd >= 0) {
+    traceEvent("job", 'i', monotonicNs(), tracePid, -1, "command", command);
+  }
+  jobs[slot].cpu = cpu;
+  jobs[slot].node = node;
+  if (cpu >= 0) {cpuJobs[cpu]++;}
+  if (limit->duration > 0) {
+    setDeadline(limit, slot);
+  }
+
+  // print the pid of the new initiated background process, kept for $!
+  lastBgPid = pids[started - 1];
+  notice("background pid is %d%s\n", pids[started - 1], describePlacement(cpu, node));
+}
+
+// Starts the queued jobs for as long as the job cap allows
+void startQueuedJobs(void) {
+  while (queueHead && (jobCap == 0 || jobCount < jobCap)) {
+    struct queuedJob *queued = queueHead;
+    queueHead = queued->next;
+    if (!queueHead) {queueTail = NULL;}
+    startJob(queued->stages, queued->stageCount, queued->command, &queued->limit);
+    freeStages(queued->stages, queued->stageCount);
+    free(queued);
+  }
+}
+
+// Records the end of a child reaped by waitpid(), when it is a background child, and notes the pid and the exit 
+// value or termination signal of its job if the job is done. Returns -1 if the child is not a background one, 1 if
+// it ended the job in watchSlot, whose wait status is then stored in watchStatus, and 0 otherwise.
+int reapJobChild(pid_t w, int childStatus, int watchSlot, int *watchStatus) {
+  if (traceFd >= 0) {
+    traceReap(w, childStatus);
+  }
+  int slot = findPid(w);
+  if (slot < 0) {return -1;}
+  unmapPid(w);
+  unsigned long long us = elapsedUs(&jobs[slot].started);
+  for (int k = 0; k < jobs[slot].pidCount; k++) {
+    if (jobs[slot].pids[k] == w) {
+      recordLatency(jobs[slot].names[k], us);
+      break;
+    }
+  }
+  if (w == jobs[slot].lastPid) {
+    jobs[slot].status = childStatus;
+  }
+  if (--jobs[slot].liveCount > 0) {return 0;}
+
+  if (traceFd >= 0) {
+    traceEvent("job done", 'i', monotonicNs(), tracePid, -1, "command", jobs[slot].command);
+  }
+  if (WIFEXITED(jobs[slot].status)) {
+    notice("background pid %d is done: exit value %d\n", jobs[slot].lastPid, WEXITSTATUS(jobs[slot].status));
+  } else {
+    notice("background pid %d is done: terminated by signal %d\n", jobs[slot].lastPid, WTERMSIG(jobs[slot].status));
+  }
+  lastDoneStatus = jobs[slot].status;
+  int watchDone = 0;
+  if (slot == watchSlot) {
+    *watchStatus = jobs[slot].status;
+    watchDone = 1;
+  }
+  freeJob(slot);
+  return watchDone;
+}
+
+void waitEvents(void);
+
+// Reaps every child that has ended with waitpid(-1), whatever the number of jobs, see reapJobChild(). With WNOHANG 
+// in options it returns when no more child has ended, without it the first wait blocks. Returns 1 if the job in 
+// watchSlot is done, its wait status being stored in watchStatus, otherwise 0.
+int reapJobs(int options, int watchSlot, int *watchStatus) {
+  int childStatus;
+  int watchDone = 0;
+  int reaped = 0;
+  pid_t w;
+  while (1) {
+    // while deadlines are set, a blocking wait is done by waiting for the events, for the deadlines to be kept
+    int waitOptions = (deadlineCount > 0) ? options | WNOHANG : options;
+    while ((w = waitpid(-1, &childStatus, waitOptions)) > 0) {
+      waitOptions |= WNOHANG;
+      options |= WNOHANG;
+      reaped = 1;
+      if (reapJobChild(w, childStatus, watchSlot, watchStatus) == 1) {
+        watchDone = 1;
+      }
+    }
+    if ((options & WNOHANG) || reaped || w < 0) {break;}
+    waitEvents();
+  }
+  startQueuedJobs();
+  return watchDone;
+}
+
+// Finds the job of a "%n" job number or of a pid, -1 if there is no such job
+int findJob(char *spec) {
+  if (spec[0] == '%') {
+    int id = atoi(spec + 1);
+    return (id > 0 && id <= jobSlots && jobs[id - 1].id == id) ? id - 1 : -1;
+  }
+  return findPid(atoi(spec));
+}
+
+// Signal numbers of the names accepted by the kill built in command
+struct signalName {
+  const char *name;
+  int number;
+} signalNames[] = {
+  {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+  {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {NULL, 0}
+};
+
+// Parses a signal given as a number or a name, with or without SIG, -1 if unknown
+int parseSignal(const char *text) {
+  if (text[0] >= '0' && text[0] <= '9') {return atoi(text);}
+  if (strncmp(text, "SIG", 3) == 0) {text += 3;}
+  for (struct signalName *sig = signalNames; sig->name; sig++) {
+    if (strcmp(sig->name, text) == 0) {return sig->number;}
+  }
+  return -1;
+}
+
+// Reads all the signals pending on the signalfd, SIGTSTP switches the foreground only mode, SIGCHLD is left to the 
+// caller to reap the children once for any number of them received
+void readSignals(void) {
+  struct signalfd_siginfo info[32];
+  ssize_t bytes;
+  while ((bytes = read(signalFd, info, sizeof(info))) > 0) {
+    for (int k = 0; k < bytes / (ssize_t)sizeof(info[0]); k++) {
+      if (info[k].ssi_signo == SIGTSTP) {
+        toggleFgOnlyMode();
+      }
+    }
+  }
+}
+
+// Nanoseconds of CLOCK_MONOTONIC
+long long monotonicNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Writes the events collected in traceBuffer to the trace file, tracing is stopped if it cannot be written
+void traceFlush(void) {
+  for (size_t done = 0; done < traceLength; ) {
+    ssize_t written = write(traceFd, traceBuffer + done, traceLength - done);
+    if (written < 0 && errno == EINTR) {continue;}
+    if (written < 0) {
+      perror(traceName);
+      close(traceFd);
+      traceFd = -1;
+      break;
+    }
+    done += written;
+  }
+  traceLength = 0;
+}
+
+// Adds text to the trace as a JSON string, with its quotes and escapes
+void traceString(const char *text) {
+  char *end = traceBuffer + traceLength;
+  *end++ = '"';
+  for (; *text; text++) {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      *end++ = '\\';
+      *end++ = c;
+    } else if (c < 0x20) {
+      end += sprintf(end, "\\u%04x", c);
+    } else {
+      *end++ = c;
+    }
+  }
+  *end++ = '"';
+  traceLength = end - traceBuffer;
+}
+
+// Adds a text without escapes to the trace
+void traceText(const char *text) {
+  size_t length = strlen(text);
+  memcpy(traceBuffer + traceLength, text, length);
+  traceLength += length;
+}
+
+// Adds a time in nanoseconds to the trace, in microseconds with three decimals, written by hand as printf() would 
+// take most of the time of an event
+void traceTime(long long ns) {
+  char digits[24];
+  int count = 0;
+  if (ns < 0) {
+    traceBuffer[traceLength++] = '-';
+    ns = -ns;
+  }
+  do {
+    digits[count++] = '0' + ns % 10;
+    ns /= 10;
+  } while (ns > 0 || count < 4);
+  while (count > 3) {traceBuffer[traceLength++] = digits[--count];}
+  traceBuffer[traceLength++] = '.';
+  while (count > 0) {traceBuffer[traceLength++] = digits[--count];}
+}
+
+// Adds an event to the trace: its name, phase (B / E for the begin / end of a slice, X for a whole slice of dur 
+// nanoseconds, i for an instant, M for metadata), time in nanoseconds and thread (the shell or a child), and one 
+// argument if argName is not NULL. The times are written in microseconds, as the format wants them.
+void traceEvent(const char *name, char phase, long long ns, pid_t tid, long long dur, const char *argName, 
+    const char *argText) {
+  // room for the longest event, a name or an argument of MAX_LEN bytes all escaped
+  if (traceLength > TRACE_BUFFER - 8 * MAX_LEN) {
+    traceFlush();
+    if (traceFd < 0) {return;}
+  }
+  traceText(traceCount++ ? ",\n{\"name\":" : "{\"name\":");
+  traceString(name);
+  traceText(",\"ph\":\"");
+  traceBuffer[traceLength++] = phase;
+  traceText("\",\"ts\":");
+  traceTime(ns);
+  traceText(",\"pid\":");
+  traceLength += sprintf(traceBuffer + traceLength, "%d,\"tid\":%d", tracePid, tid);
+  if (dur >= 0) {
+    traceText(",\"dur\":");
+    traceTime(dur);
+  }
+  if (phase == 'i') {
+    traceText(",\"s\":\"t\"");
+  }
+  if (argName) {
+    traceText(",\"args\":{\"");
+    traceText(argName);
+    traceText("\":");
+    traceString(argText);
+    traceBuffer[traceLength++] = '}';
+  }
+  traceBuffer[traceLength++] = '}';
+}
+
+// Adds the exec() of the forked children, as sent on tracePipe, to the trace
+void traceExecs(void) {
+  struct traceExec records[64];
+  ssize_t bytes;
+  while ((bytes = read(tracePipe[0], records, sizeof(records))) > 0) {
+    for (size_t k = 0; k < bytes / sizeof(struct traceExec); k++) {
+      traceEvent("exec", 'i', records[k].ns, records[k].pid, -1, NULL, NULL);
+    }
+  }
+}
+
+// Adds a new child to the trace, on a thread of its own named after the command: the time taken to start it on the 
+// thread of the shell, and the beginning of its slice, with its exec() if it is done already
+void traceChild(pid_t pid, const char *name, long long forkNs, int execDone) {
+  long long now = monotonicNs();
+  char threadName[64];
+  snprintf(threadName, sizeof(threadName), "%.48s %d", name, pid);
+  traceEvent("thread_name", 'M', 0, pid, -1, "name", threadName);
+  traceEvent("fork", 'X', forkNs, tracePid, now - forkNs, "command", name);
+  traceEvent(name, 'B', forkNs, pid, -1, NULL, NULL);
+  if (execDone) {
+    traceEvent("exec", 'i', now, pid, -1, NULL, NULL);
+  }
+}
+
+// Adds the end of a reaped child to the trace, with its exit value or termination signal
+void traceReap(pid_t pid, int childStatus) {
+  char status[32];
+  traceExecs();
+  if (WIFEXITED(childStatus)) {
+    sprintf(status, "exit value %d", WEXITSTATUS(childStatus));
+  } else {
+    sprintf(status, "signal %d", WTERMSIG(childStatus));
+  }
+  traceEvent("reap", 'E', monotonicNs(), pid, -1, "status", status);
+}
+
+// Stops tracing, the file is ended as a complete JSON array
+void traceClose(void) {
+  if (traceFd < 0) {return;}
+  traceExecs();
+  traceFlush();
+  if (traceFd >= 0) {
+    write(traceFd, "\n]\n", 3);
+    close(traceFd);
+    traceFd = -1;
+  }
+  free(traceName);
+  traceName = NULL;
+}
+
+// Starts tracing to the file, stopping the trace in progress if any, returns -1 (after a message) if the file cannot 
+// be opened
+int traceOpen(const char *file) {
+  traceClose();
+  if (tracePipe[0] < 0 && pipe2(tracePipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+    perror("pipe");
+    return -1;
+  }
+  if ((traceFd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600)) < 0) {
+    perror(file);
+    return -1;
+  }
+  if (!traceBuffer) {traceBuffer = malloc(TRACE_BUFFER);}
+  traceName = strdup(file);
+  tracePid = getpid();
+  traceCount = 0;
+  traceLength = sprintf(traceBuffer, "[\n");
+  traceEvent("process_name", 'M', 0, tracePid, -1, "name", "smallsh");
+  traceEvent("thread_name", 'M', 0, tracePid, -1, "name", "shell");
+  // exec records left in the pipe by an earlier trace are dropped
+  struct traceExec records[64];
+  while (read(tracePipe[0], records, sizeof(records)) > 0) {}
+  return 0;
+}
+
+// Arms the timerfd for the earliest deadline, or disarms it when there is none
+void armTimer(void) {
+  struct itimerspec timer = {{0, 0}, {0, 0}};
+  if (deadlineCount > 0) {
+    timer.it_value.tv_sec = deadlines[0].when / 1000000000LL;
+    timer.it_value.tv_nsec = deadlines[0].when % 1000000000LL;
+    // a zero time would disarm it, a deadline already passed fires at once anyway
+    if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0) {timer.it_value.tv_nsec = 1;}
+  }
+  timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+// Adds a deadline to the heap, moving it up from the end to its place
+void pushDeadline(struct deadline entry) {
+  if (deadlineCount == deadlineCapacity) {
+    deadlineCapacity = deadlineCapacity ? deadlineCapacity * 2 : 64;
+    deadlines = realloc(deadlines, deadlineCapacity * sizeof(struct deadline));
+  }
+  int i = deadlineCount++;
+  while (i > 0 && deadlines[(i - 1) / 2].when > entry.when) {
+    deadlines[i] = deadlines[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  deadlines[i] = entry;
+}
+
+// Takes the earliest deadline out of the heap, the last one moving down from the top to its place
+struct deadline popDeadline(void) {
+  struct deadline top = deadlines[0];
+  struct deadline last = deadlines[--deadlineCount];
+  int i = 0;
+  while (2 * i + 1 < deadlineCount) {
+    int child = 2 * i + 1;
+    if (child + 1 < deadlineCount && deadlines[child + 1].when < deadlines[child].when) {child++;}
+    if (deadlines[child].when >= last.when) {break;}
+    deadlines[i] = deadlines[child];
+    i = child;
+  }
+  if (deadlineCount > 0) {deadlines[i] = last;}
+  return top;
+}
+
+// Sets a deadline on the background job in slot, or on the foreground children when slot is -1
+void setDeadline(struct timeoutSpec *limit, int slot) {
+  struct deadline entry;
+  entry.when = monotonicNs() + limit->duration;
+  entry.slot = slot;
+  entry.serial = (slot >= 0) ? jobs[slot].serial : fgSerial;
+  entry.signal = limit->signal;
+  entry.grace = limit->grace;
+  pushDeadline(entry);
+  if (deadlines[0].when == entry.when) {armTimer();}
+}
+
+// Sends the signals of the deadlines that have passed, to the job or the foreground children they were set on if 
+// they are still running, and sets the deadline of SIGKILL after the grace period if there is one
+void expireDeadlines(void) {
+  uint64_t expirations;
+  read(timerFd, &expirations, sizeof(expirations));
+  long long now = monotonicNs();
+  while (deadlineCount > 0 && deadlines[0].when <= now) {
+    struct deadline entry = popDeadline();
+    if (entry.slot >= 0 && jobs[entry.slot].id > 0 && jobs[entry.slot].serial == entry.serial) {
+      kill(-jobs[entry.slot].pgid, entry.signal);
+    } else if (entry.slot < 0 && fgPids && entry.serial == fgSerial) {
+      for (int s = 0; s < fgCount; s++) {
+        if (fgPids[s] > 0) {kill(fgPids[s], entry.signal);}
+      }
+    } else {
+      continue;
+    }
+    if (entry.grace > 0) {
+      entry.when = now + entry.grace;
+      entry.signal = SIGKILL;
+      entry.grace = 0;
+      pushDeadline(entry);
+    }
+  }
+  armTimer();
+}
+
+// Waits until a child may have ended or a deadline passed, and sends the signals of the deadlines
+void waitEvents(void) {
+  struct pollfd pollFds[2] = {{signalFd, POLLIN, 0}, {timerFd, POLLIN, 0}};
+  if (poll(pollFds, 2, -1) < 0) {return;}
+  if (pollFds[1].revents) {expireDeadlines();}
+  if (pollFds[0].revents) {readSignals();}
+}
+
+// Waits for the foreground child pid, with wait4(). While deadlines are set it waits for events instead, for the 
+// deadlines to be kept while the child runs.
+pid_t waitChild(pid_t pid, int *childStatus, struct rusage *usage) {
+  pid_t w;
+  if (deadlineCount == 0) {
+    do {
+      w = wait4(pid, childStatus, 0, usage);
+    } while (w < 0 && errno == EINTR);
+  } else {
+    while ((w = wait4(pid, childStatus, WNOHANG, usage)) == 0) {
+      waitEvents();
+    }
+  }
+  if (w > 0 && traceFd >= 0) {
+    traceReap(w, *childStatus);
+  }
+  return w;
+}
+
+// Parses a duration as a number of seconds, with a fraction and an s, m, h or d suffix, into nanoseconds, -1 if it
+// is not one
+long long parseDuration(const char *text) {
+  char *end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0) {return -1;}
+  if (*end == 'm') {value *= 60;}
+  else if (*end == 'h') {value *= 3600;}
+  else if (*end == 'd') {value *= 86400;}
+  else if (*end && *end != 's') {return -1;}
+  if (*end && end[1]) {return -1;}
+  return (long long)(value * 1e9);
+}
+
+// Handles the signals pending on the signalfd and the deadlines that have passed, and reaps the background children
+// that have ended, nothing is done in signal handlers
+void handleSignals(void) {
+  readSignals();
+  if (deadlineCount > 0) {expireDeadlines();}
+  reapJobs(WNOHANG, -1, NULL);
+}
+
+// Sets up the signalfd, the timerfd and the epoll set of the event loop, with the input and them in it
+void setupEventLoop(void) {
+  sigset_t shellSignals;
+  struct epoll_event event = {0};
+
+  sigemptyset(&shellSignals);
+  sigaddset(&shellSignals, SIGCHLD);
+  sigaddset(&shellSignals, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &shellSignals, NULL);
+  signalFd = signalfd(-1, &shellSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (signalFd < 0 || epollFd < 0 || timerFd < 0) {
+    perror("event loop");
+    exit(1);
+  }
+  event.events = EPOLLIN;
+  event.data.fd = signalFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+  event.data.fd = timerFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+
+  // a regular file cannot be added (EPERM), it is read without waiting then
+  event.data.fd = inputFd;
+  inputPollable = (inputFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, inputFd, &event) == 0);
+}
+
+// Returns the next line of input, without its newline, and its length, or NULL at the end of the input. The input
+// is read in large chunks and split in place. While waiting for input the signals are handled as they come, and the
+// notices they produced are written at once, followed by a new prompt if interactive. The length of a line longer 
+// than MAX_LEN is returned as MAX_LEN + 1 (its content is not usable), and the rest of that line is skipped.
+char *readLine(size_t *length) {
+  struct epoll_event events[3];
+  while (1) {
+    char *start = inputData + inputStart;
+    char *newline = memchr(start, '\n', inputEnd - inputStart);
+    if (newline) {
+      *newline = '\0';
+      *length = newline - start;
+      inputStart += *length + 1;
+      if (inputSkipping) {
+        inputSkipping = 0;
+        continue;
+      }
+      return start;
+    }
+    if (inputEnd - inputStart > MAX_LEN) {
+      // too long to be a command, the line is dropped up to its newline
+      inputSkipping = 1;
+      inputStart = inputEnd = 0;
+      *length = MAX_LEN + 1;
+      return inputData;
+    }
+    if (inputEof) {
+      // the last line may have no newline at the end
+      if (inputEnd > inputStart && !inputSkipping) {
+        inputData[inputEnd] = '\0';
+        *length = inputEnd - inputStart;
+        inputStart = inputEnd;
+        return start;
+      }
+      errno = 0;
+      return NULL;
+    }
+
+    // move the partial line to the front to make room for the next read
+    if (inputStart > 0) {
+      memmove(inputData, start, inputEnd - inputStart);
+      inputEnd -= inputStart;
+      inputStart = 0;
+    }
+
+    if (inputPollable) {
+      int ready = epoll_wait(epollFd, events, 3, -1);
+      int inputReady = 0;
+      for (int k = 0; k < ready; k++) {
+        if (events[k].data.fd == timerFd) {
+          expireDeadlines();
+        } else if (events[k].data.fd == signalFd) {
+          handleSignals();
+          if (noticeLength > 0) {
+            flushNotices(interactive);
+          }
+        } else {
+          inputReady = 1;
+        }
+      }
+      if (!inputReady) {continue;}
+    }
+
+    ssize_t bytes = read(inputFd, inputData + inputEnd, INPUT_BUFFER - 1 - inputEnd);
+    if (bytes == 0) {
+      inputEof = 1;
+    } else if (bytes < 0 && errno != EINTR && errno != EAGAIN) {
+      return NULL;
+    } else if (bytes > 0) {
+      inputEnd += bytes;
+    }
+  }
+}
+
+// Reads all the lines of a file into the arena, for the parallel built in command, and returns them as an array
+// of count strings
+char **readLinesInto(int fd, int *count) {
+  char chunk[65536];
+  ssize_t bytes;
+  while ((bytes = read(fd, chunk, sizeof(chunk))) > 0) {
+    arenaPut(chunk, bytes);
+  }
+  char *text = arenaEndWord();
+  int lineCount = 0;
+  for (char *c = text; *c; c++) {
+    if (*c == '\n') {lineCount++;}
+  }
+  char **lines = arenaAlloc((lineCount + 1) * sizeof(char *));
+  *count = 0;
+  for (char *c = text; *c; ) {
+    char *newline = strchrnul(c, '\n');
+    int atEnd = (*newline == '\0');
+    *newline = '\0';
+    if (newline > c) {lines[(*count)++] = c;}
+    if (atEnd) {break;}
+    c = newline + 1;
+  }
+  return lines;
+}
+
+// Prints the status of an item of the parallel built in command, the way the status command does
+void reportItem(struct parallelItem *item) {
+  if (WIFEXITED(item->status)) {
+    printf("%s: exit value %d\n", item->arg, WEXITSTATUS(item->status));
+  } else {
+    printf("%s: terminated by signal %d\n", item->arg, WTERMSIG(item->status));
+  }
+  fflush(stdout);
+}
+
+// The parallel built in command: parallel [-j N] [-k] [command ...] [::: arg ... | :::: file]. The command is run 
+// once for each argument, with {} in its words replaced by the argument (or the argument added at the end if there 
+// is no {}), keeping up to N of them running (the number of online CPUs by default) and starting the next one as 
+// soon as one ends. The arguments are the words after :::, or the lines of the file after ::::, of the input 
+// redirection, or of stdin when the commands are not read from it. The status of each argument is reported as it 
+// ends, or with -k in the order of the arguments after its output, which is kept until then. The status of the 
+// command is the number of arguments that failed. Returns -1 (after a message) for wrong arguments.
+int runParallel(char **args, char *inputFile) {
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int keepOrder = 0;
+  int k = 1;
+
+  while (args[k] && args[k][0] == '-' && args[k][1] != '\0') {
+    if (strcmp(args[k], "-k") == 0) {
+      keepOrder = 1;
+      k++;
+    } else if (strncmp(args[k], "-j", 2) == 0 && (args[k][2] || args[k + 1])) {
+      workers = atol(args[k][2] ? args[k] + 2 : args[k + 1]);
+      k += args[k][2] ? 1 : 2;
+    } else {
+      break;
+    }
+  }
+  if (workers < 1) {
+    workers = 1;
+  }
+
+  // the command is given until ::: or ::::
+  char **template = &args[k];
+  int templateCount = 0;
+  while (args[k] && strcmp(args[k], ":::") != 0 && strcmp(args[k], "::::") != 0) {
+    templateCount++;
+    k++;
+  }
+  int hasPlaceholder = 0;
+  for (int t = 0; t < templateCount; t++) {
+    if (strstr(template[t], "{}")) {hasPlaceholder = 1;}
+  }
+
+  // the arguments to run the command with
+  char **itemArgs;
+  int itemCount = 0;
+  int sourceFd = -1;
+  if (args[k] && strcmp(args[k], ":::") == 0) {
+    itemArgs = &args[k + 1];
+    while (itemArgs[itemCount]) {itemCount++;}
+  } else {
+    char *sourceFile = (args[k] && args[k + 1]) ? args[k + 1] : inputFile;
+    if (sourceFile) {
+      if ((sourceFd = open(sourceFile, O_RDONLY | O_CLOEXEC)) < 0) {
+        printf("cannot open %s for input\n", sourceFile);
+        fflush(stdout);
+        return -1;
+      }
+    } else if (inputFd != 0 || interactive) {
+      sourceFd = 0;
+    } else {
+      printf("parallel: give the arguments after ::: or in a file after ::::\n");
+      fflush(stdout);
+      return -1;
+    }
+    itemArgs = readLinesInto(sourceFd, &itemCount);
+    if (sourceFd > 0) {close(sourceFd);}
+  }
+  // without a command every argument is run as a command of its own, template[0] is then not a word of the command
+  if (templateCount == 0) {
+    hasPlaceholder = 0;
+  }
+
+  struct parallelItem *items = arenaAlloc((itemCount + 1) * sizeof(struct parallelItem));
+  struct pollfd *pollFds = malloc((workers + 1) * sizeof(struct pollfd));
+  int *running = malloc(workers * sizeof(int));
+  char **argv = malloc((templateCount + 2) * sizeof(char *));
+  char *words = NULL;
+  size_t wordsCapacity = 0;
+  int runningCount = 0, next = 0, reported = 0, failed = 0, interrupted = 0;
+
+  for (int i = 0; i < itemCount; i++) {
+    items[i].arg = itemArgs[i];
+    items[i].pid = 0;
+    items[i].outFd = -1;
+    items[i].output = NULL;
+    items[i].outputLength = 0;
+    items[i].outputCapacity = 0;
+  }
+
+  while (reported < itemCount) {
+    // keep the workers busy
+    while (runningCount < workers && next < itemCount && !interrupted) {
+      struct parallelItem *item = &items[next];
+      struct stage st = {argv, NULL, NULL, NULL};
+      size_t argLength = strlen(item->arg);
+      size_t needed = 0;
+      for (int t = 0; t < templateCount; t++) {needed += strlen(template[t]) * (argLength + 1) + 1;}
+      if (needed > wordsCapacity) {
+        wordsCapacity = needed * 2;
+        words = realloc(words, wordsCapacity);
+      }
+
+      // build the words of the command, with each {} replaced
+      char *end = words;
+      int argc = 0;
+      for (int t = 0; t < templateCount; t++) {
+        argv[argc++] = end;
+        for (char *c = template[t]; *c; c++) {
+          if (c[0] == '{' && c[1] == '}') {
+            end = stpcpy(end, item->arg);
+            c++;
+          } else {
+            *end++ = *c;
+          }
+        }
+        *end++ = '\0';
+      }
+      if (!hasPlaceholder) {argv[argc++] = item->arg;}
+      argv[argc] = NULL;
+      if (templateCount == 0 || strcmp(argv[0], template[0]) == 0) {
+        item->name = (templateCount == 0) ? item->arg : template[0];
+      } else {
+        arenaPut(argv[0], strlen(argv[0]));
+        item->name = arenaEndWord();
+      }
+
+      int outPipe[2] = {-1, -1};
+      if (keepOrder && pipe2(outPipe, O_CLOEXEC) < 0) {
+        perror("pipe");
+        interrupted = 1;
+        break;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &item->started);
+      if (runPipeline(&st, 1, 0, -1, outPipe[1], &item->pid) == 0) {
+        item->pid = -1;
+        item->status = 1 << 8;
+      }
+      if (keepOrder) {
+        close(outPipe[1]);
+        item->outFd = outPipe[0];
+      }
+      running[runningCount++] = next;
+      next++;
+    }
+    if (interrupted && runningCount == 0 && next < itemCount) {
+      // the items not started are dropped after CTRL-C
+      itemCount = next;
+      if (reported >= itemCount) {break;}
+    }
+
+    // wait for a child to end, or for output of the running items, pollFds[r + 1] is for running[r]
+    pollFds[0].fd = signalFd;
+    pollFds[0].events = POLLIN;
+    for (int r = 0; r < runningCount; r++) {
+      pollFds[r + 1].fd = items[running[r]].outFd;
+      pollFds[r + 1].events = POLLIN;
+    }
+    int timeout = -1;
+    for (int r = 0; r < runningCount; r++) {
+      if (items[running[r]].pid == -1 && items[running[r]].outFd < 0) {timeout = 0;}
+    }
+    if (deadlineCount > 0) {
+      // the deadlines of the background jobs are kept meanwhile
+      long long left = (deadlines[0].when - monotonicNs()) / 1000000 + 1;
+      if (timeout < 0 || left < timeout) {timeout = left > 0 ? left : 0;}
+    }
+    if (poll(pollFds, runningCount + 1, timeout) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    if (deadlineCount > 0 && deadlines[0].when <= monotonicNs()) {
+      expireDeadlines();
+    }
+
+    // keep the output of the items with -k, until their end
+    for (int r = 0; r < runningCount; r++) {
+      struct parallelItem *item = &items[running[r]];
+      if (pollFds[r + 1].fd < 0 || pollFds[r + 1].revents == 0) {continue;}
+      if (item->outputLength + 65536 > item->outputCapacity) {
+        item->outputCapacity = (item->outputLength + 65536) * 2;
+        item->output = realloc(item->output, item->outputCapacity);
+      }
+      ssize_t bytes = read(item->outFd, item->output + item->outputLength, 65536);
+      if (bytes > 0) {
+        item->outputLength += bytes;
+      } else if (bytes == 0 || errno != EINTR) {
+        close(item->outFd);
+        item->outFd = -1;
+      }
+    }
+
+    // reap the children that ended, background ones go to the job table
+    if (pollFds[0].revents) {
+      int childStatus;
+      struct rusage usage;
+      pid_t w;
+      readSignals();
+      while ((w = wait4(-1, &childStatus, WNOHANG, &usage)) > 0) {
+        if (reapJobChild(w, childStatus, -1, NULL) >= 0) {continue;}
+        for (int r = 0; r < runningCount; r++) {
+          if (items[running[r]].pid == w) {
+            items[running[r]].pid = -1;
+            items[running[r]].status = childStatus;
+            recordLatency(items[running[r]].name, elapsedUs(&items[running[r]].started));
+            addUsage(&usage);
+            break;
+          }
+        }
+      }
+    }
+
+    // free the workers whose item ended, with its output complete for -k, and report them
+    for (int r = 0; r < runningCount; ) {
+      struct parallelItem *item = &items[running[r]];
+      if (item->pid != -1 || item->outFd >= 0) {
+        r++;
+        continue;
+      }
+      if (WIFSIGNALED(item->status) && WTERMSIG(item->status) == SIGINT) {
+        interrupted = 1;
+      }
+      if (!WIFEXITED(item->status) || WEXITSTATUS(item->status) != 0) {
+        failed++;
+      }
+      if (!keepOrder) {
+        reportItem(item);
+        reported++;
+      }
+      running[r] = running[--runningCount];
+    }
+    if (keepOrder) {
+      // an item is reported in order once it ended and its output is complete
+      while (reported < next && items[reported].pid == -1 && items[reported].outFd < 0) {
+        fflush(stdout);
+        if (items[reported].outputLength > 0) {
+          write(1, items[reported].output, items[reported].outputLength);
+        }
+        free(items[reported].output);
+        reportItem(&items[reported]);
+        reported++;
+      }
+    }
+  }
+  startQueuedJobs();
+
+  free(pollFds);
+  free(running);
+  free(argv);
+  free(words);
+  return failed > 255 ? 255 : failed;
+}
+
+// Exits the shell with the given exit value, killing the background jobs, every job in its process group
+void exitShell(int exitValue) {
+  for(int slot = 0; slot < jobSlots; slot++){
+    if (jobs[slot].id > 0) {kill(-jobs[slot].pgid, SIGKILL);}
+  }
+  reportTime();
+  traceClose();
+  flushNotices(0);
+  exit(exitValue);
+}
+
+// Sets the status reported by the status command from a wait status
+void setLastStatus(int childStatus) {
+  if (WIFEXITED(childStatus)) {
+    lastStatusType = 0;
+    lastStatus = WEXITSTATUS(childStatus);
+  } else {
+    lastStatusType = 1;
+    lastStatus = WTERMSIG(childStatus);
+  }
+}
+
+// --------------------------------------------------------------------------------------------------
+// Fast built in commands: common utilities run inside the shell instead of forking a child, they behave like 
+// the coreutils binaries of the same name, and are disabled with enable -n to run the binaries again
+// --------------------------------------------------------------------------------------------------
+
+// Writes the character of the backslash escape at text (after the backslash) to stdout, returns the number of 
+// characters used, or -1 for \c, which ends the output. With octalZero the octal escapes start with 0 (\0nnn, 
+// as for echo -e), otherwise they are \nnn (as in the format of printf)
+int putEscape(const char *text, int octalZero) {
+  const char *c = text;
+  int value = 0, digits = 0;
+  switch (*c) {
+    case 'a': putchar('\a'); return 1;
+    case 'b': putchar('\b'); return 1;
+    case 'c': return -1;
+    case 'e': putchar('\033'); return 1;
+    case 'f': putchar('\f'); return 1;
+    case 'n': putchar('\n'); return 1;
+    case 'r': putchar('\r'); return 1;
+    case 't': putchar('\t'); return 1;
+    case 'v': putchar('\v'); return 1;
+    case '\\': putchar('\\'); return 1;
+    case 'x':
+      for (c++; digits < 2 && isxdigit((unsigned char)*c); c++, digits++) {
+        value = value * 16 + (isdigit((unsigned char)*c) ? *c - '0' : (tolower((unsigned char)*c) - 'a' + 10));
+      }
+      if (digits == 0) {
+        fputs("\\x", stdout);
+        return 1;
+      }
+      putchar(value);
+      return c - text;
+  }
+  if (*c >= '0' && *c <= '7' && (!octalZero || *c == '0')) {
+    if (octalZero) {c++;}
+    for (; digits < 3 && *c >= '0' && *c <= '7'; c++, digits++) {
+      value = value * 8 + *c - '0';
+    }
+    putchar(value);
+    return c - text;
+  }
+  putchar('\\');
+  return 0;
+}
+
+int fastEcho(char **args) {
+  int newline = 1, escapes = 0, k = 1;
+  // options are only taken while every letter of the word is one of n, e and E
+  for (; args[k] && args[k][0] == '-' && args[k][1] && strspn(args[k] + 1, "neE") == strlen(args[k] + 1); k++) {
+    for (char *c = args[k] + 1; *c; c++) {
+      if (*c == 'n') {newline = 0;}
+      else {escapes = (*c == 'e');}
+    }
+  }
+  for (int first = k; args[k]; k++) {
+    if (k > first) {putchar(' ');}
+    if (!escapes) {
+      fputs(args[k], stdout);
+      continue;
+    }
+    for (char *c = args[k]; *c; c++) {
+      if (*c != '\\' || !c[1]) {
+        putchar(*c);
+        continue;
+      }
+      int used = putEscape(c + 1, 1);
+      if (used < 0) {return 0;}
+      c += used;
+    }
+  }
+  if (newline) {putchar('\n');}
+  return 0;
+}
+
+int fastTrue(char **args) {
+  return 0;
+}
+
+int fastFalse(char **args) {
+  return 1;
+}
+
+int fastPwd(char **args) {
+  char *cwd = getcwd(NULL, 0);
+  if (!cwd) {
+    perror("pwd");
+    return 1;
+  }
+  puts(cwd);
+  free(cwd);
+  return 0;
+}
+
+// Parser of the expression of test, with the words left in testArgs[testNext..testCount - 1], testError is set 
+// (after a message) when the expression is not valid
+char **testArgs;
+int testNext, testCount, testError;
+
+// Integer operand of test, sets testError if it is not one
+long long testInteger(const char *text) {
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 10);
+  while (*end == ' ' || *end == '\t') {end++;}
+  if (end == text || *end || errno) {
+    fprintf(stderr, "test: invalid integer '%s'\n", text);
+    testError = 1;
+  }
+  return value;
+}
+
+int testUnary(char op, const char *operand) {
+  struct stat info;
+  if (op == 'n') {return operand[0] != '\0';}
+  if (op == 'z') {return operand[0] == '\0';}
+  if (op == 't') {return isatty(testInteger(operand));}
+  if (op == 'r') {return access(operand, R_OK) == 0;}
+  if (op == 'w') {return access(operand, W_OK) == 0;}
+  if (op == 'x') {return access(operand, X_OK) == 0;}
+  if (op == 'h' || op == 'L') {return lstat(operand, &info) == 0 && S_ISLNK(info.st_mode);}
+  if (stat(operand, &info) != 0) {return 0;}
+  switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(info.st_mode);
+    case 'd': return S_ISDIR(info.st_mode);
+    case 'b': return S_ISBLK(info.st_mode);
+    case 'c': return S_ISCHR(info.st_mode);
+    case 'p': return S_ISFIFO(info.st_mode);
+    case 'S': return S_ISSOCK(info.st_mode);
+    case 's': return info.st_size > 0;
+    case 'u': return (info.st_mode & S_ISUID) != 0;
+    case 'g': return (info.st_mode & S_ISGID) != 0;
+    case 'k': return (info.st_mode & S_ISVTX) != 0;
+    case 'O': return info.st_uid == geteuid();
+    case 'G': return info.st_gid == getegid();
+  }
+  return 0;
+}
+
+// Whether the word is a unary operator of test, as -f
+int isTestUnary(const char *word) {
+  return word[0] == '-' && word[1] && !word[2] && strchr("nztrwxhLefdbcpSsugkOG", word[1]);
+}
+
+// Result of the binary operator op, or -1 if op is not one
+int testBinary(const char *left, const char *op, const char *right) {
+  static const char *intOps[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL};
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {return strcmp(left, right) == 0;}
+  if (strcmp(op, "!=") == 0) {return strcmp(left, right) != 0;}
+  if (strcmp(op, "<") == 0) {return strcmp(left, right) < 0;}
+  if (strcmp(op, ">") == 0) {return strcmp(left, right) > 0;}
+  for (int i = 0; intOps[i]; i++) {
+    if (strcmp(op, intOps[i]) != 0) {continue;}
+    long long a = testInteger(left), b = testInteger(right);
+    int results[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return results[i];
+  }
+  if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+    struct stat a, b;
+    int hasA = stat(left, &a) == 0, hasB = stat(right, &b) == 0;
+    if (op[1] == 'e') {return hasA && hasB && a.st_dev == b.st_dev && a.st_ino == b.st_ino;}
+    if (!hasA || !hasB) {return op[1] == 'n' ? hasA : hasB;}
+    int newer = a.st_mtim.tv_sec > b.st_mtim.tv_sec || 
+        (a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec > b.st_mtim.tv_nsec);
+    int older = b.st_mtim.tv_sec > a.st_mtim.tv_sec || 
+        (b.st_mtim.tv_sec == a.st_mtim.tv_sec && b.st_mtim.tv_nsec > a.st_mtim.tv_nsec);
+    return op[1] == 'n' ? newer : older;
+  }
+  return -1;
+}
+
+int testOr(void);
+
+// primary: ( expression ) | -op word | word op word | word
+int testPrimary(void) {
+  int left = testCount - testNext;
+  if (left <= 0) {
+    fprintf(stderr, "test: argument expected\n");
+    testError = 1;
+    return 0;
+  }
+  char **word = testArgs + testNext;
+  if (left >= 3) {
+    int result = testBinary(word[0], word[1], word[2]);
+    if (result >= 0) {
+      testNext += 3;
+      return result;
+    }
+  }
+  if (strcmp(word[0], "(") == 0 && left >= 2) {
+    testNext++;
+    int result = testOr();
+    if (testNext >= testCount || strcmp(testArgs[testNext], ")") != 0) {
+      fprintf(stderr, "test: ')' expected\n");
+      testError = 1;
+      return 0;
+    }
+    testNext++;
+    return result;
+  }
+  if (left >= 2 && isTestUnary(word[0])) {
+    testNext += 2;
+    return testUnary(word[0][1], word[1]);
+  }
+  testNext++;
+  return word[0][0] != '\0';
+}
+
+int testNot(void) {
+  int negate = 0;
+  while (testNext < testCount - 1 && strcmp(testArgs[testNext], "!") == 0) {
+    negate = !negate;
+    testNext++;
+  }
+  return testPrimary() ^ negate;
+}
+
+int testAnd(void) {
+  int result = testNot();
+  while (testNext < testCount && strcmp(testArgs[testNext], "-a") == 0) {
+    testNext++;
+    result = testNot() && result;
+  }
+  return result;
+}
+
+int testOr(void) {
+  int result = testAnd();
+  while (testNext < testCount && strcmp(testArgs[testNext], "-o") == 0) {
+    testNext++;
+    result = testAnd() || result;
+  }
+  return result;
+}
+
+// test and [, 0 if the expression is true, 1 if it is false and 2 if it is not valid
+int fastTest(char **args) {
+  int count = 0;
+  while (args[count]) {count++;}
+  if (strcmp(args[0], "[") == 0) {
+    if (strcmp(args[count - 1], "]") != 0) {
+      fprintf(stderr, "[: missing ']'\n");
+      return 2;
+    }
+    count--;
+  }
+  testArgs = args;
+  testNext = 1;
+  testCount = count;
+  testError = 0;
+  if (count == 1) {return 1;}
+  // with up to four words, ! and the binary operators are taken before the meaning of the words, as POSIX asks
+  int result;
+  if (count == 3 && strcmp(args[1], "!") == 0) {
+    result = args[2][0] == '\0';
+    testNext = 3;
+  } else if (count == 4 && (result = testBinary(args[1], args[2], args[3])) >= 0) {
+    testNext = 4;
+  } else {
+    result = testOr();
+  }
+  if (!testError && testNext < testCount) {
+    fprintf(stderr, "test: extra argument '%s'\n", testArgs[testNext]);
+    testError = 1;
+  }
+  return testError ? 2 : !result;
+}
+
+// Numeric argument of printf, a leading quote gives the value of the character after it
+long long printfInteger(const char *text, int *failed) {
+  if (text[0] == '\'' || text[0] == '"') {return (unsigned char)text[1];}
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 0);
+  if (errno == ERANGE || end == text || *end) {
+    fprintf(stderr, "printf: '%s': %s\n", text, end == text ? "expected a numeric value" : 
+        (errno == ERANGE ? "Numerical result out of range" : "value not completely converted"));
+    *failed = 1;
+  }
+  return value;
+}
+
+// printf format [argument ...], the format is reused until all the arguments are used
+int fastPrintf(char **args) {
+  if (!args[1]) {
+    fprintf(stderr, "printf: missing operand\n");
+    return 1;
+  }
+  char *format = args[1];
+  char **arg = args + 2;
+  int failed = 0;
+  do {
+    int usedArg = 0;
+    for (char *c = format; *c; c++) {
+      if (*c == '\\' && c[1]) {
+        int used = putEscape(c + 1, 0);
+        if (used < 0) {return failed;}
+        c += used;
+        continue;
+      }
+      if (*c != '%') {
+        putchar(*c);
+        continue;
+      }
+      if (c[1] == '%') {
+        putchar('%');
+        c++;
+        continue;
+      }
+
+      // build the conversion for the printf() of the C library: flags, width, precision, then the conversion
+      char spec[64];
+      int length = 0;
+      char *start = c++;
+      c += strspn(c, "-+ #0");
+      if (*c == '*') {
+        c++;
+      } else {
+        c += strspn(c, "0123456789");
+      }
+      if (*c == '.') {
+        c++;
+        if (*c == '*') {
+          c++;
+        } else {
+          c += strspn(c, "0123456789");
+        }
+      }
+      if (!*c || !strchr("diouxXeEfFgGaAcsb", *c) || c - start > 40) {
+        fprintf(stderr, "printf: %.*s: invalid conversion specification\n", (int)(c - start + (*c != 0)), start);
+        return 1;
+      }
+      length = c - start;
+      memcpy(spec, start, length);
+      spec[length] = '\0';
+
+      // the * of the width and precision take their values from the arguments
+      int stars[2], starCount = 0;
+      for (char *s = spec; *s; s++) {
+        if (*s == '*') {
+          stars[starCount++] = *arg ? (int)printfInteger(*arg++, &failed) : 0;
+          usedArg = 1;
+        }
+      }
+      char *value = *arg ? *arg++ : NULL;
+      if (value) {usedArg = 1;}
+      char conversion = *c;
+
+      if (conversion == 'b') {
+        // %b prints the argument with its backslash escapes, \c stops all the output
+        for (char *v = value ? value : ""; *v; v++) {
+          if (*v != '\\' || !v[1]) {
+            putchar(*v);
+            continue;
+          }
+          int used = putEscape(v + 1, 1);
+          if (used < 0) {return failed;}
+          v += used;
+        }
+        continue;
+      }
+      if (strchr("diouxXc", conversion)) {
+        if (conversion != 'c') {
+          spec[length++] = 'l';
+          spec[length++] = 'l';
+        }
+      } else if (strchr("eEfFgGaA", conversion)) {
+        spec[length++] = 'L';
+      }
+      spec[length++] = conversion;
+      spec[length] = '\0';
+
+      if (conversion == 's') {
+        if (starCount == 2) {printf(spec, stars[0], stars[1], value ? value : "");}
+        else if (starCount == 1) {printf(spec, stars[0], value ? value : "");}
+        else {printf(spec, value ? value : "");}
+      } else if (conversion == 'c') {
+        int ch = value ? (unsigned char)value[0] : '\0';
+        if (starCount == 2) {printf(spec, stars[0], stars[1], ch);}
+        else if (starCount == 1) {printf(spec, stars[0], ch);}
+        else {printf(spec, ch);}
+      } else if (strchr("diouxX", conversion)) {
+        long long number = value ? printfInteger(value, &failed) : 0;
+        if (starCount == 2) {printf(spec, stars[0], stars[1], number);}
+        else if (starCount == 1) {printf(spec, stars[0], number);}
+        else {printf(spec, number);}
+      } else {
+        long double number = 0;
+        if (value) {
+          char *end;
+          number = strtold(value, &end);
+          if (end == value || *end) {
+            fprintf(stderr, "printf: '%s': expected a numeric value\n", value);
+            failed = 1;
+          }
+        }
+        if (starCount == 2) {printf(spec, stars[0], stars[1], number);}
+        else if (starCount == 1) {printf(spec, stars[0], number);}
+        else {printf(spec, number);}
+      }
+    }
+    // the format is used again for the arguments left, as long as it takes any
+    if (!usedArg) {break;}
+  } while (*arg);
+  return failed;
+}
+
+// The fast built in commands, with whether each one is enabled
+struct fastBuiltin {
+  const char *name;
+  int (*run)(char **args);
+  int enabled;
+};
+
+struct fastBuiltin fastBuiltins[] = {
+  {"echo", fastEcho, 1},
+  {"true", fastTrue, 1},
+  {"false", fastFalse, 1},
+  {"pwd", fastPwd, 1},
+  {"test", fastTest, 1},
+  {"[", fastTest, 1},
+  {"printf", fastPrintf, 1},
+  {NULL, NULL, 0}
+};
+
+// The fast built in command of the given name, or NULL if there is none or it is disabled
+struct fastBuiltin *findFastBuiltin(const char *name) {
+  for (struct fastBuiltin *builtin = fastBuiltins; builtin->name; builtin++) {
+    if (strcmp(builtin->name, name) == 0) {return builtin->enabled ? builtin : NULL;}
+  }
+  return NULL;
+}
+
+// Puts the < and > redirections of a stage run inside the shell on its stdin / stdout, the ones of the shell being 
+// saved in savedIn and savedOut (-1 if not redirected) for restoreBuiltin(). Returns -1 (after a message) if a 
+// redirection cannot be opened, nothing being changed then.
+int redirectBuiltin(struct stage *st, int *savedIn, int *savedOut) {
+  int inFd = -1, outFd = -1;
+  *savedIn = -1;
+  *savedOut = -1;
+  if (st->inputFile && (inFd = open(st->inputFile, O_RDONLY | O_CLOEXEC)) < 0) {
+    printf("cannot open %s for input\n", st->inputFile);
+    fflush(stdout);
+    return -1;
+  }
+  if (st->outputFile && (outFd = open(st->outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600)) < 0) {
+    printf("cannot open %s for output\n", st->outputFile);
+    fflush(stdout);
+    if (inFd >= 0) {close(inFd);}
+    return -1;
+  }
+  fflush(stdout);
+  if (inFd >= 0) {
+    *savedIn = fcntl(0, F_DUPFD_CLOEXEC, 10);
+    dup2(inFd, 0);
+    close(inFd);
+  }
+  if (outFd >= 0) {
+    *savedOut = fcntl(1, F_DUPFD_CLOEXEC, 10);
+    dup2(outFd, 1);
+    close(outFd);
+  }
+  return 0;
+}
+
+// Puts the stdin / stdout of the shell saved by redirectBuiltin() back, after the output is flushed. Returns -1 if
+// the output could not be written, as to a full disk.
+int restoreBuiltin(int savedIn, int savedOut) {
+  int failed = 0;
+  if (fflush(stdout) != 0 || ferror(stdout)) {
+    failed = -1;
+    clearerr(stdout);
+  }
+  if (savedIn >= 0) {
+    dup2(savedIn, 0);
+    close(savedIn);
+  }
+  if (savedOut >= 0) {
+    dup2(savedOut, 1);
+    close(savedOut);
+  }
+  return failed;
+}
+
+// Runs a fast built in command in the shell with the redirections of the stage, the stdin / stdout of the shell are 
+// saved and put back after it, returns its exit value (1 if a redirection cannot be opened, as for a child)
+int runFastBuiltin(struct fastBuiltin *builtin, struct stage *st) {
+  int savedIn, savedOut;
+  if (redirectBuiltin(st, &savedIn, &savedOut) < 0) {
+    return 1;
+  }
+  int status = builtin->run(st->args);
+  // a failed write, as to a full disk, fails the command as it would fail the binary
+  if (restoreBuiltin(savedIn, savedOut) < 0 && status == 0) {
+    status = 1;
+  }
+  return status;
+}
+
+
+void runCommand(struct stage *stages, int stageCount, int isBg);
+
+// History of the lines entered, kept across sessions in two files appended to and never rewritten: the log of the 
+// lines, each ending with a newline, and the index of the offset of each line in the log as a 64 bit number, for 
+// entry n to be found without reading the log. Both are mapped read-only, and mapped again when they have grown. 
+// A line is appended to both under an flock() of the log, for the shells sharing the files to keep them in step.
+int historyLogFd = -1;
+int historyIndexFd = -1;
+int historyOpened;                // 1 once the files were opened, or failed to be
+char *historyLog;
+size_t historyLogSize;
+uint64_t *historyIndex;
+size_t historyCount;              // entries mapped, entry n is historyIndex[n - 1]
+char historyLine[MAX_LEN + 1];    // a line with a ! replaced with an entry
+
+// Prefix index of the history, for !prefix: the entries sorted by their line, then by number, made on the first 
+// search for the entries there are then, and a segment tree giving the last entry of a range of them. The entries 
+// added since are searched one by one, until there are more than HISTORY_UNSORTED of them, or a 16th of the index, 
+// and the index is made again.
+#define HISTORY_UNSORTED 4096
+uint32_t *historyOrder;
+uint32_t *historyTree;
+size_t historyOrderCount;
+
+// Opens the history files, $SMALLSH_HISTFILE or ~/.smallsh_history and the index file with .idx after its name, 
+// nothing is read from them here. Returns -1 if they cannot be opened.
+int openHistory(void) {
+  if (historyOpened) {return historyIndexFd >= 0 ? 0 : -1;}
+  historyOpened = 1;
+  char path[PATH_MAX];
+  if (getenv("SMALLSH_HISTFILE")) {
+    snprintf(path, sizeof(path) - 4, "%s", getenv("SMALLSH_HISTFILE"));
+  } else if (getenv("HOME")) {
+    snprintf(path, sizeof(path) - 4, "%s/.smallsh_history", getenv("HOME"));
+  } else {
+    return -1;
+  }
+  if ((historyLogFd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 00600)) < 0) {
+    perror(path);
+    return -1;
+  }
+  strcat(path, ".idx");
+  if ((historyIndexFd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 00600)) < 0) {
+    perror(path);
+    close(historyLogFd);
+    historyLogFd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// Maps the history files again if they have grown, with the entries added by the other shells. The index is looked
+// at first, as its entries are written after their lines.
+void syncHistory(void) {
+  struct stat sb;
+  if (fstat(historyIndexFd, &sb) == 0 && (size_t)sb.st_size / sizeof(uint64_t) != historyCount) {
+    if (historyIndex) {munmap(historyIndex, historyCount * sizeof(uint64_t));}
+    historyCount = sb.st_size / sizeof(uint64_t);
+    historyIndex = mmap(NULL, historyCount * sizeof(uint64_t), PROT_READ, MAP_SHARED, historyIndexFd, 0);
+    if (historyIndex == MAP_FAILED) {
+      historyIndex = NULL;
+      historyCount = 0;
+    }
+  }
+  if (fstat(historyLogFd, &sb) == 0 && (size_t)sb.st_size != historyLogSize) {
+    if (historyLog) {munmap(historyLog, historyLogSize);}
+    historyLogSize = sb.st_size;
+    historyLog = mmap(NULL, historyLogSize, PROT_READ, MAP_SHARED, historyLogFd, 0);
+    if (historyLog == MAP_FAILED) {
+      historyLog = NULL;
+      historyLogSize = 0;
+    }
+  }
+}
+
+// Line of entry n of the history (from 1) and its length, NULL if it is not in the log
+const char *historyEntry(size_t n, size_t *length) {
+  uint64_t offset = historyIndex[n - 1];
+  if (offset >= historyLogSize) {return NULL;}
+  const char *end = memchr(historyLog + offset, '\n', historyLogSize - offset);
+  *length = end ? (size_t)(end - (historyLog + offset)) : historyLogSize - offset;
+  return historyLog + offset;
+}
+
+// Appends a line to the history
+void addHistory(const char *line, size_t length) {
+  if (openHistory() < 0) {return;}
+  struct stat sb;
+  flock(historyLogFd, LOCK_EX);
+  // an index cut by a crash is cut back to whole entries
+  if (fstat(historyIndexFd, &sb) == 0 && sb.st_size % sizeof(uint64_t) != 0) {
+    ftruncate(historyIndexFd, sb.st_size - sb.st_size % sizeof(uint64_t));
+  }
+  if (fstat(historyLogFd, &sb) == 0) {
+    uint64_t offset = sb.st_size;
+    struct iovec parts[2] = {{(void *)line, length}, {"\n", 1}};
+    if (writev(historyLogFd, parts, 2) == (ssize_t)length + 1) {
+      write(historyIndexFd, &offset, sizeof(offset));
+    }
+  }
+  flock(historyLogFd, LOCK_UN);
+}
+
+// Entry of the history being sorted, with its line, and the first 16 bytes of the line as two numbers that sort as 
+// they do, for most comparisons not to read the lines
+struct sortedEntry {
+  uint64_t key[2];
+  const char *line;
+  uint32_t length;
+  uint32_t entry;
+};
+
+// Compares the lines of two entries of the history, for the prefix index
+int compareEntries(const void *a, const void *b) {
+  const struct sortedEntry *sortedA = a, *sortedB = b;
+  if (sortedA->key[0] != sortedB->key[0]) {return sortedA->key[0] < sortedB->key[0] ? -1 : 1;}
+  if (sortedA->key[1] != sortedB->key[1]) {return sortedA->key[1] < sortedB->key[1] ? -1 : 1;}
+  uint32_t length = sortedA->length < sortedB->length ? sortedA->length : sortedB->length;
+  int result = length > 16 ? memcmp(sortedA->line + 16, sortedB->line + 16, length - 16) : 0;
+  if (result == 0 && sortedA->length != sortedB->length) {result = sortedA->length < sortedB->length ? -1 : 1;}
+  if (result == 0) {result = sortedA->entry < sortedB->entry ? -1 : 1;}
+  return result;
+}
+
+// Compares the start of the line of an entry with a prefix: 0 if the line starts with it
+int comparePrefix(uint32_t entry, const char *prefix, size_t prefixLength) {
+  size_t length = 0;
+  const char *line = historyEntry(entry, &length);
+  int result = memcmp(line ? line : "", prefix, length < prefixLength ? length : prefixLength);
+  if (result == 0 && length < prefixLength) {result = -1;}
+  return result;
+}
+
+// Makes the prefix index for all the entries
+void sortHistory(void) {
+  size_t count = historyCount;
+  struct sortedEntry *sorted = malloc(count * sizeof(struct sortedEntry));
+  for (size_t k = 0; k < count; k++) {
+    size_t length = 0;
+    const char *line = historyEntry(k + 1, &length);
+    if (!line) {line = "";}
+    sorted[k].key[0] = sorted[k].key[1] = 0;
+    for (size_t b = 0; b < 16; b++) {
+      sorted[k].key[b / 8] = (sorted[k].key[b / 8] << 8) | (b < length ? (unsigned char)line[b] : 0);
+    }
+    sorted[k].line = line;
+    sorted[k].length = length;
+    sorted[k].entry = k + 1;
+  }
+  qsort(sorted, count, sizeof(struct sortedEntry), compareEntries);
+  historyOrder = realloc(historyOrder, count * sizeof(uint32_t));
+  historyTree = realloc(historyTree, 2 * count * sizeof(uint32_t));
+  for (size_t k = 0; k < count; k++) {historyOrder[k] = sorted[k].entry;}
+  free(sorted);
+  // the leaves of the tree are the entries in order, each node above keeps the greatest entry below it
+  memcpy(historyTree + count, historyOrder, count * sizeof(uint32_t));
+  for (size_t k = count - 1; k > 0; k--) {
+    historyTree[k] = historyTree[2 * k] > historyTree[2 * k + 1] ? historyTree[2 * k] : historyTree[2 * k + 1];
+  }
+  historyOrderCount = count;
+}
+
+// Number of the last entry of the history starting with prefix, 0 if there is none
+size_t findHistory(const char *prefix, size_t prefixLength) {
+  // the last entries are searched one by one first, they are the ones added since the index was made, or the ones
+  // a common prefix is found in without making the index
+  size_t unsorted = historyOrderCount / 16 > HISTORY_UNSORTED ? historyOrderCount / 16 : HISTORY_UNSORTED;
+  size_t stop = historyCount - historyOrderCount > unsorted ? historyCount - unsorted : historyOrderCount;
+  for (size_t n = historyCount; n > stop; n--) {
+    if (comparePrefix(n, prefix, prefixLength) == 0) {return n;}
+  }
+  if (historyCount - historyOrderCount > unsorted) {
+    sortHistory();
+  }
+
+  // the entries starting with the prefix follow each other in the index, from the first one not before the prefix
+  size_t low = 0, high = historyOrderCount;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (comparePrefix(historyOrder[middle], prefix, prefixLength) < 0) {low = middle + 1;} else {high = middle;}
+  }
+  size_t first = low;
+  high = historyOrderCount;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (comparePrefix(historyOrder[middle], prefix, prefixLength) <= 0) {low = middle + 1;} else {high = middle;}
+  }
+
+  // the greatest entry of the range, from the tree
+  size_t last = 0;
+  for (size_t l = first + historyOrderCount, r = low + historyOrderCount; l < r; l /= 2, r /= 2) {
+    if (l & 1) {
+      if (historyTree[l] > last) {last = historyTree[l];}
+      l++;
+    }
+    if (r & 1) {
+      r--;
+      if (historyTree[r] > last) {last = historyTree[r];}
+    }
+  }
+  return last;
+}
+
+// Replaces the ! at the start of a line with an entry of the history: !! the last one, !n entry n, !-n the nth one 
+// before the end, and !prefix the last one starting with prefix, the rest of the line is kept after it. The new line 
+// is printed, and returned in historyLine. Returns NULL (after a message) if there is no such entry.
+char *expandHistory(char *line, size_t *lineLength) {
+  size_t designator = strcspn(line + 1, " ") + 1;
+  size_t n = 0;
+  if (openHistory() < 0) {return NULL;}
+  syncHistory();
+  if (line[1] == '!') {
+    designator = 2;
+    n = historyCount;
+  } else if (isdigit((unsigned char)line[1]) || (line[1] == '-' && isdigit((unsigned char)line[2]))) {
+    char *end;
+    long long number = strtoll(line + 1, &end, 10);
+    designator = end - line;
+    if (number < 0) {number += historyCount + 1;}
+    if (number > 0 && (size_t)number <= historyCount) {n = number;}
+  } else {
+    n = findHistory(line + 1, designator - 1);
+  }
+
+  size_t length = 0;
+  const char *entry = n > 0 ? historyEntry(n, &length) : NULL;
+  if (!entry) {
+    fprintf(stderr, "%.*s: event not found\n", (int)designator, line);
+    return NULL;
+  }
+  size_t rest = *lineLength - designator;
+  if (length + rest > MAX_LEN) {
+    write(2,"You exceeded the command length. Please try again!\n",51); 
+    return NULL;
+  }
+  memcpy(historyLine, entry, length);
+  memcpy(historyLine + length, line + designator, rest + 1);
+  *lineLength = length + rest;
+  printf("%s\n", historyLine);
+  fflush(stdout);
+  return historyLine;
+}
+
+// Names of the built in commands other than the fast ones, a command substitution runs them in a forked copy of 
+// the shell
+const char *builtinNames[] = {"cd", "exit", "status", "pipesize", "hash", "jobs", "wait", "kill", "jobcap", "parallel", 
+    "sched", "trace", "set", "export", "unset", "history", "stats", "enable", "repeat", "for", "time", 
+    "timeout", NULL};
+
+// The built in commands of runCommand() that print something, run with the < and > redirections of their line
+const char *listingBuiltins[] = {"status", "pipesize", "hash", "jobs", "jobcap", "sched", "trace", "stats", "enable",
+    "set", "export", "history", NULL};
+
+// Starts a forked copy of the shell, which runs commands itself, without the state that belongs to the shell: the 
+// jobs and the queued jobs with the job cap, the deadlines with a timerfd of its own (the one of the shell is shared
+// with it), the placement counters, the zygote helper, the timing and the trace, the shell keeping all of them
+void resetChildState(void) {
+  jobSlots = 0;
+  jobFree = -1;
+  jobCount = 0;
+  pidKeys = NULL;
+  pidSlots = NULL;
+  pidTableSize = 0;
+  pidTableUsed = 0;
+  queueHead = NULL;
+  queueTail = NULL;
+  jobCap = 0;
+  jobPolicy = POLICY_QUEUE;
+  deadlineCount = 0;
+  fgCount = 0;
+  close(timerFd);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  placeNext = 0;
+  memset(cpuJobs, 0, sizeof(cpuJobs));
+  zygoteFd = -1;
+  timing = 0;
+  traceFd = -1;
+}
+
+// Runs the command line of a $(...) with its stdout on a pipe, and reads its output with large reads into 
+// captureBuffer, the status is set by the command. An external command or pipeline is started directly, while a 
+// built in command or a loop runs in a forked copy of the shell. Returns the length of the output without its 
+// trailing newlines, or -1 (after a message) if the command could not be run or its output is over SUBST_MAX bytes.
+ssize_t captureCommand(const char *text, size_t length) {
+  struct command inner;
+  arenaPut(text, length);
+  int parsed = parseLine(arenaEndWord(), &inner);
+  if (parsed <= 0) {return parsed;}
+
+  // the built in commands expand their words themselves, in the copy of the shell
+  int inShell = 0;
+  if (inner.stageCount == 1) {
+    inShell = findFastBuiltin(inner.stages[0].args[0]) != NULL;
+    for (const char **name = builtinNames; *name && !inShell; name++) {
+      inShell = strcmp(*name, inner.stages[0].args[0]) == 0;
+    }
+  }
+  if (!inShell && expandStages(inner.stages, inner.stageCount) < 0) {
+    return -1;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    perror("pipe");
+    return -1;
+  }
+  pid_t pids[inner.stageCount];
+  int started = 1;
+  struct timespec startTime;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  if (inShell) {
+    fflush(stdout);
+    pids[0] = fork();
+    if (pids[0] < 0) {
+      perror("fork()");
+      started = 0;
+    } else if (pids[0] == 0) {
+      resetChildState();
+      dup2(fds[1], 1);
+      runCommand(inner.stages, 1, 0);
+      fflush(stdout);
+      exit(lastStatusType ? 128 + lastStatus : lastStatus);
+    }
+  } else {
+    started = runPipeline(inner.stages, inner.stageCount, 0, -1, fds[1], pids);
+  }
+  close(fds[1]);
+
+  // read until the end of the output, the reading stops when it gets over SUBST_MAX, the command gets SIGPIPE then
+  size_t used = 0;
+  int tooLarge = 0;
+  while (started > 0) {
+    if (captureCapacity - used < 65536) {
+      captureCapacity = (used + 65536) * 2;
+      if (captureCapacity > SUBST_MAX + 65536) {captureCapacity = SUBST_MAX + 65536;}
+      captureBuffer = realloc(captureBuffer, captureCapacity);
+    }
+    ssize_t bytes = read(fds[0], captureBuffer + used, captureCapacity - used);
+    if (bytes < 0 && errno == EINTR) {continue;}
+    if (bytes <= 0) {break;}
+    used += bytes;
+    if (used > SUBST_MAX) {
+      tooLarge = 1;
+      break;
+    }
+  }
+  close(fds[0]);
+
+  // wait for every stage, the last stage sets the status
+  for (int s = 0; s < started; s++) {
+    struct rusage usage;
+    int childStatus;
+    if (waitChild(pids[s], &childStatus, &usage) < 0) {continue;}
+    recordLatency(inner.stages[s].args[0], elapsedUs(&startTime));
+    addUsage(&usage);
+    if (s == inner.stageCount - 1) {setLastStatus(childStatus);}
+  }
+  if (started == 0) {return -1;}
+  if (tooLarge) {
+    write(2,"The output of $(...) is too large. Please try again!\n",53);
+    return -1;
+  }
+  while (used > 0 && captureBuffer[used - 1] == '\n') {used--;}
+  return used;
+}
+
+// Runs the body of a repeat or for loop count times from its parsed stages, only the variables are expanded again for 
+// each run, on a copy of the arguments. For a for loop the variable is set to the next word of the list before each 
+// run. The loop stops early if a run is terminated by CTRL-C.
+void runLoop(struct stage *body, int stageCount, int isBg, const char *var, char **list, long count) {
+  struct stage *run = arenaAlloc(stageCount * sizeof(struct stage));
+  char **args[stageCount];
+  int argCounts[stageCount];
+  for (int s = 0; s < stageCount; s++) {
+    argCounts[s] = 0;
+    while (body[s].args[argCounts[s]]) {argCounts[s]++;}
+    args[s] = arenaAlloc((argCounts[s] + 1) * sizeof(char *));
+  }
+  struct arenaPosition start = arenaSave();
+
+  lastStatusType = 0;
+  lastStatus = 0;
+  for (long i = 0; i < count; i++) {
+    if (var) {setenv(var, list[i], 1);}
+    for (int s = 0; s < stageCount; s++) {
+      memcpy(args[s], body[s].args, (argCounts[s] + 1) * sizeof(char *));
+      run[s] = body[s];
+      run[s].args = args[s];
+    }
+    runCommand(run, stageCount, isBg);
+
+    // what was expanded for this run is released, and the jobs that ended meanwhile are reaped
+    arenaRestore(start);
+    handleSignals();
+    if (lastStatusType && lastStatus == SIGINT) {break;}
+  }
+}
+
+// Takes the parts of a "for VAR in word ...; do command; done" line apart: the list of words and the body of the loop,
+// which starts in the first stage after do, and ends in the last stage before done. Returns the number of words of 
+// the list (in *list, and the body in the stages), -1 if the line is not a valid for loop, or -2 (after a message) 
+// if its list could not be expanded.
+int parseFor(struct stage *stages, int stageCount, char ***list) {
+  char **args = stages[0].args;
+  int last = stageCount - 1;
+  int argCount = 0;
+  while (stages[last].args[argCount]) {argCount++;}
+  if (!args[1] || !args[2] || strcmp(args[2], "in") != 0 || 
+      !(isalpha((unsigned char)args[1][0]) || args[1][0] == '_') || strspn(args[1], 
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != strlen(args[1])) {
+    return -1;
+  }
+  if (argCount < 2 || strcmp(stages[last].args[argCount - 1], "done") != 0) {
+    return -1;
+  }
+
+  // done, and the ; before it, are taken out, with the redirections of the last stage now at its end, the words are 
+  // not changed for the loop to be parsed again when it is in the body of another loop
+  stages[last].args[--argCount] = NULL;
+  char *lastWord = stages[last].args[argCount - 1];
+  size_t length = strlen(lastWord);
+  if (strcmp(lastWord, ";") == 0) {
+    stages[last].args[--argCount] = NULL;
+  } else if (lastWord[length - 1] == ';') {
+    arenaPut(lastWord, length - 1);
+    stages[last].args[argCount - 1] = arenaEndWord();
+  }
+  stripRedirections(&stages[last], argCount);
+
+  // the list ends with a ; alone or at the end of its last word, and do follows it
+  int w = 3;
+  while (args[w] && strcmp(args[w], ";") != 0 && args[w][strlen(args[w]) - 1] != ';') {w++;}
+  if (!args[w]) {return -1;}
+  int listCount = w - 3;
+  if (strcmp(args[w], ";") != 0) {
+    arenaPut(args[w], strlen(args[w]) - 1);
+    args[w] = arenaEndWord();
+    listCount++;
+  }
+  if (!args[w + 1] || strcmp(args[w + 1], "do") != 0 || !args[w + 2]) {
+    return -1;
+  }
+  stages[0].args = args + w + 2;
+
+  // the words of the list are expanded once, a substitution or a pattern can give any number of them
+  *list = arenaAlloc((MAX_ARG + 1) * sizeof(char *));
+  int count = 0;
+  for (int k = 0; k < listCount; k++) {
+    if (!strchr(args[3 + k], '$') && !isPattern(args[3 + k])) {
+      (*list)[count++] = args[3 + k];
+      continue;
+    }
+    int words = expandArg(args[3 + k], *list + count, MAX_ARG - count);
+    if (words < 0) {return -2;}
+    count += words;
+  }
+  return count;
+}
+
+// Runs a parsed command: a built in command, a fast built in one, or the children of a pipeline in the foreground or 
+// as a background job
+void runCommand(struct stage *stages, int stageCount, int isBg) {
+  char **enteredargs = stages[0].args;
+  struct fastBuiltin *fast;
+
+  // time in front of a command reports what it used once it ended, a background command is not timed
+  int timed = 0;
+  if (strcmp(enteredargs[0], "time") == 0 && enteredargs[1]) {
+    stages[0].args++;
+    enteredargs++;
+    if (!isBg && !timing) {
+      timing = timed = 1;
+      memset(&timedUsage, 0, sizeof(timedUsage));
+      clock_gettime(CLOCK_MONOTONIC, &timedStart);
+    }
+  }
+
+  // a loop runs its body with the words as they are, to expand the variables again at each run
+  if (strcmp(enteredargs[0], "repeat") == 0) {
+    char *end, *countWord = enteredargs[1];
+    if (countWord && strchr(countWord, '$') && expandWord(enteredargs[1], &countWord, 1) != 1) {
+      countWord = NULL;
+    }
+    long count = countWord ? strtol(countWord, &end, 10) : -1;
+    if (!countWord || !enteredargs[2] || *end || count < 0) {
+      printf("repeat: usage: repeat count command\n");
+      fflush(stdout);
+      lastStatusType = 0;
+      lastStatus = 2;
+    } else {
+      stages[0].args += 2;
+      runLoop(stages, stageCount, isBg, NULL, NULL, count);
+    }
+    if (timed) {reportTime();}
+    return;
+  }
+  if (strcmp(enteredargs[0], "for") == 0) {
+    char **list;
+    int listCount = parseFor(stages, stageCount, &list);
+    if (listCount == -2) {
+      lastStatusType = 0;
+      lastStatus = 1;
+    } else if (listCount < 0) {
+      printf("for: usage: for name in word ...; do command; done\n");
+      fflush(stdout);
+      lastStatusType = 0;
+      lastStatus = 2;
+    } else {
+      runLoop(stages, stageCount, isBg, enteredargs[1], list, listCount);
+    }
+    if (timed) {reportTime();}
+    return;
+  }
+  if (expandStages(stages, stageCount) < 0) {
+    lastStatusType = 0;
+    lastStatus = 1;
+    if (timed) {reportTime();}
+    return;
+  }
+  enteredargs = stages[0].args;
+
+  // timeout in front of a command sets a time limit on its children, in the foreground or in the background, the 
+  // built in commands are run without it
+  struct timeoutSpec limit = {0, SIGTERM, 0};
+  if (strcmp(enteredargs[0], "timeout") == 0 && enteredargs[1]) {
+    int k = 1;
+    while (enteredargs[k] && enteredargs[k + 1] && enteredargs[k][0] == '-') {
+      if (strcmp(enteredargs[k], "-s") == 0) {
+        limit.signal = parseSignal(enteredargs[k + 1]);
+      } else if (strcmp(enteredargs[k], "-k") == 0) {
+        limit.grace = parseDuration(enteredargs[k + 1]);
+      } else {
+        break;
+      }
+      k += 2;
+    }
+    limit.duration = parseDuration(enteredargs[k]);
+    if (limit.signal <= 0 || limit.grace < 0 || limit.duration < 0 || !enteredargs[k + 1]) {
+      printf("timeout: usage: timeout [-s signal] [-k duration] duration command\n");
+      fflush(stdout);
+      lastStatusType = 0;
+      lastStatus = 125;
+      if (timed) {reportTime();}
+      return;
+    }
+    stages[0].args += k + 1;
+    enteredargs = stages[0].args;
+  }
+
+  // --------------------------------------------------------------------------------------------------
+  // After having organized the args array, process the user input
+  // --------------------------------------------------------------------------------------------------
+  
+  // the built in commands that print something write it to the redirections of the line, as the fast ones do
+  int savedIn = -1, savedOut = -1;
+  int redirected = 0;
+  if (stageCount == 1 && (stages[0].inputFile || stages[0].outputFile)) {
+    for (const char **name = listingBuiltins; *name && !redirected; name++) {
+      redirected = strcmp(*name, enteredargs[0]) == 0;
+    }
+  }
+  if (redirected && redirectBuiltin(&stages[0], &savedIn, &savedOut) < 0) {
+    lastStatusType = 0;
+    lastStatus = 1;
+    if (timed) {reportTime();}
+    return;
+  }
+
+  // built in commands, only when not part of a pipeline
+  if (stageCount == 1 && strcmp(enteredargs[0], "cd") == 0) {
+    if (enteredargs[1]) {
+      if(chdir(enteredargs[1])) {
+        perror(enteredargs[1]);
+      }
+    } else { 
+      if(chdir(getenv("HOME"))) {
+        perror("HOME directory not defined");
+      } 
+    }
+    // cached paths found through relative PATH directories point somewhere else now
+    if (pathHasRelative) {
+      clearPathCache();
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "hash") == 0) {
+    if (enteredargs[1] && strcmp(enteredargs[1], "-r") == 0) {
+      clearPathCache();
+    } else if (enteredargs[1]) {
+      // add the given commands to the cache
+      for (int k = 1; enteredargs[k]; k++) {
+        if (!strchr(enteredargs[k], '/') && !lookupCommand(enteredargs[k])) {
+          printf("hash: %s: not found\n", enteredargs[k]);
+        }
+      }
+    } else {
+      printf("hits\tcommand\n");
+      for (int b = 0; b < PATH_BUCKETS; b++) {
+        for (struct pathEntry *entry = pathCache[b]; entry; entry = entry->next) {
+          printf("%4lu\t%s\n", entry->hits, entry->path);
+        }
+      }
+      printf("lookups: %lu hits, %lu misses\n", pathHits, pathMisses);
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "exit") == 0) {
+    // kill the children and terminate the parent
+    exitShell(0);
+
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "status") == 0) {
+    if (lastStatusType) {
+      printf("terminated by signal %d\n", lastStatus);    
+      fflush(stdout);
+    } else {
+      printf("exit value %d\n", lastStatus);    
+      fflush(stdout);
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "pipesize") == 0) {
+    // without an argument print the current setting, 0 stands for the default size of the kernel
+    if (enteredargs[1]) {
+      int requested = atoi(enteredargs[1]);
+      int fds[2];
+      // try the size on a spare pipe, the kernel rounds it up to a power of two number of pages
+      if (requested <= 0) {
+        pipeSize = 0;
+      } else if (pipe(fds) == 0) {
+        int applied = fcntl(fds[1], F_SETPIPE_SZ, requested);
+        if (applied < 0) {
+          perror("pipesize");
+        } else {
+          pipeSize = applied;
+        }
+        close(fds[0]);
+        close(fds[1]);
+      }
+    }
+    printf("pipe size %d\n", pipeSize);
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "jobs") == 0) {
+    for (int slot = 0; slot < jobSlots; slot++) {
+      if (jobs[slot].id > 0) {
+        printf("[%d] %d running%s  %s\n", jobs[slot].id, jobs[slot].lastPid, 
+            describePlacement(jobs[slot].cpu, jobs[slot].node), jobs[slot].command);
+      }
+    }
+    for (struct queuedJob *queued = queueHead; queued; queued = queued->next) {
+      printf("[-] queued  %s\n", queued->command);
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "wait") == 0) {
+    // without an argument wait for all the jobs, queued ones included, otherwise for the one given as pid or %n
+    if (enteredargs[1]) {
+      int slot = findJob(enteredargs[1]);
+      int jobStatus;
+      if (slot < 0) {
+        printf("wait: %s: no such job\n", enteredargs[1]);
+        fflush(stdout);
+        lastStatusType = 0;
+        lastStatus = 127;
+      } else {
+        while (!reapJobs(0, slot, &jobStatus)) {}
+        setLastStatus(jobStatus);
+      }
+    } else {
+      // the status is the one of the last job to end while waiting, it is kept if no job was running
+      lastDoneStatus = -1;
+      while (jobCount > 0 || queueHead) {
+        reapJobs(0, -1, NULL);
+      }
+      if (lastDoneStatus != -1) {
+        setLastStatus(lastDoneStatus);
+      }
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "kill") == 0) {
+    // kill [-signal | -s signal] pid | %n ..., a job is signalled as a whole through its process group
+    int sig = SIGTERM;
+    int k = 1;
+    if (enteredargs[k] && strcmp(enteredargs[k], "-s") == 0 && enteredargs[k + 1]) {
+      sig = parseSignal(enteredargs[k + 1]);
+      k += 2;
+    } else if (enteredargs[k] && enteredargs[k][0] == '-') {
+      sig = parseSignal(enteredargs[k] + 1);
+      k++;
+    }
+    if (sig < 0) {
+      printf("kill: invalid signal\n");
+    } else if (!enteredargs[k]) {
+      printf("kill: usage: kill [-signal | -s signal] pid | %%n ...\n");
+    }
+    for (; sig >= 0 && enteredargs[k]; k++) {
+      pid_t target;
+      if (enteredargs[k][0] == '%') {
+        int slot = findJob(enteredargs[k]);
+        if (slot < 0) {
+          printf("kill: %s: no such job\n", enteredargs[k]);
+          continue;
+        }
+        target = -jobs[slot].pgid;
+      } else {
+        target = atoi(enteredargs[k]);
+      }
+      if (target == 0 || kill(target, sig) < 0) {
+        printf("kill: %s: %s\n", enteredargs[k], target == 0 ? "invalid pid" : strerror(errno));
+      }
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "jobcap") == 0) {
+    // jobcap [max [queue | reject | block]], 0 means no cap, without arguments the setting is printed
+    if (enteredargs[1]) {
+      jobCap = atoi(enteredargs[1]);
+      if (jobCap < 0) {jobCap = 0;}
+      if (enteredargs[2]) {
+        int policy = 0;
+        while (policy < 3 && strcmp(policyNames[policy], enteredargs[2]) != 0) {policy++;}
+        if (policy < 3) {
+          jobPolicy = policy;
+        } else {
+          printf("jobcap: %s: policy should be queue, reject or block\n", enteredargs[2]);
+        }
+      }
+      // a higher cap may leave room for queued jobs
+      startQueuedJobs();
+    }
+    if (jobCap > 0) {
+      printf("at most %d background jobs, %s the others\n", jobCap, policyNames[jobPolicy]);
+    } else {
+      printf("no cap on background jobs\n");
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "sched") == 0) {
+    // sched [policy none | round-robin | pack | numa] [nice n] [batch on | off], without arguments the setting is 
+    // printed
+    for (int k = 1; enteredargs[k]; k += 2) {
+      char *value = enteredargs[k + 1];
+      if (value && strcmp(enteredargs[k], "policy") == 0) {
+        int policy = 0;
+        while (policy < 4 && strcmp(placeNames[policy], value) != 0) {policy++;}
+        if (policy < 4) {
+          placePolicy = policy;
+          placeNext = 0;
+        } else {
+          printf("sched: %s: policy should be none, round-robin, pack or numa\n", value);
+        }
+      } else if (value && strcmp(enteredargs[k], "nice") == 0) {
+        bgNice = atoi(value);
+      } else if (value && strcmp(enteredargs[k], "batch") == 0 && 
+          (strcmp(value, "on") == 0 || strcmp(value, "off") == 0)) {
+        bgBatch = strcmp(value, "on") == 0;
+      } else {
+        printf("sched: usage: sched [policy none | round-robin | pack | numa] [nice n] [batch on | off]\n");
+        break;
+      }
+    }
+    if (cpuCount == 0) {readTopology();}
+    printf("background jobs: policy %s, nice %+d, batch %s, %d cpus on %d node%s\n", placeNames[placePolicy], bgNice, 
+        bgBatch ? "on" : "off", cpuCount, nodeCount, nodeCount > 1 ? "s" : "");
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "trace") == 0) {
+    // trace on file starts writing the trace to the file, trace off ends it, without arguments the state is printed
+    if (enteredargs[1] && strcmp(enteredargs[1], "on") == 0 && enteredargs[2]) {
+      traceOpen(enteredargs[2]);
+    } else if (enteredargs[1] && strcmp(enteredargs[1], "off") == 0) {
+      traceClose();
+    } else if (enteredargs[1]) {
+      printf("trace: usage: trace [on file | off]\n");
+    }
+    if (traceFd >= 0) {
+      printf("tracing to %s\n", traceName);
+    } else {
+      printf("tracing off\n");
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "parallel") == 0) {
+    int failed = runParallel(enteredargs, stages[0].inputFile);
+    if (failed >= 0) {
+      lastStatusType = 0;
+      lastStatus = failed;
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "stats") == 0) {
+    // -j prints JSON, -r forgets the statistics collected so far
+    if (enteredargs[1] && strcmp(enteredargs[1], "-r") == 0) {
+      resetStats();
+    } else if (enteredargs[1] && strcmp(enteredargs[1], "-j") != 0) {
+      printf("stats: usage: stats [-j | -r]\n");
+      fflush(stdout);
+    } else {
+      printStats(enteredargs[1] != NULL);
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "enable") == 0) {
+    // enable -n name runs the binary for a fast built in command again, enable name the built in one
+    int disable = enteredargs[1] && strcmp(enteredargs[1], "-n") == 0;
+    if (!enteredargs[1 + disable]) {
+      for (struct fastBuiltin *builtin = fastBuiltins; builtin->name; builtin++) {
+        printf("enable %s%s\n", builtin->enabled ? "" : "-n ", builtin->name);
+      }
+    }
+    for (int k = 1 + disable; enteredargs[k]; k++) {
+      struct fastBuiltin *builtin = fastBuiltins;
+      while (builtin->name && strcmp(builtin->name, enteredargs[k]) != 0) {builtin++;}
+      if (builtin->name) {
+        builtin->enabled = !disable;
+      } else {
+        printf("enable: %s: not a fast built in command\n", enteredargs[k]);
+      }
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && !(isBg && !fgOnlyMode) && !stages[0].outputFiles && 
+      (fast = findFastBuiltin(enteredargs[0]))) {
+    // a fast built in command runs in the shell, the binary is used in the background and in pipelines
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    lastStatusType = 0;
+    lastStatus = runFastBuiltin(fast, &stages[0]);
+    recordLatency(enteredargs[0], elapsedUs(&started));
+    if (errExit && lastStatus != 0) {
+      exitShell(lastStatus);
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "set") == 0) {
+    // set -o name switches an option on, set +o name off, -x / +x the same by letter, and without arguments the 
+    // options are listed
+    if (enteredargs[1] && enteredargs[2] && (strcmp(enteredargs[1], "-o") == 0 || strcmp(enteredargs[1], "+o") == 0)) {
+      struct shellOption *opt = shellOptions;
+      while (opt->name && strcmp(opt->name, enteredargs[2]) != 0) {opt++;}
+      if (opt->name) {
+        *opt->value = (enteredargs[1][0] == '-');
+      } else {
+        printf("set: %s: invalid option name\n", enteredargs[2]);
+      }
+    } else if (enteredargs[1] && (enteredargs[1][0] == '-' || enteredargs[1][0] == '+') && enteredargs[1][1]) {
+      for (char *letter = enteredargs[1] + 1; *letter; letter++) {
+        struct shellOption *opt = shellOptions;
+        while (opt->name && opt->letter != *letter) {opt++;}
+        if (opt->name) {
+          *opt->value = (enteredargs[1][0] == '-');
+        } else {
+          printf("set: -%c: invalid option\n", *letter);
+        }
+      }
+    } else if (enteredargs[1]) {
+      printf("set: usage: set [-o|+o option] [-e|+e]\n");
+    } else {
+      for (struct shellOption *opt = shellOptions; opt->name; opt++) {
+        printf("%-12s%s\n", opt->name, *opt->value ? "on" : "off");
+      }
+    }
+    fflush(stdout);
+    // the zygote helper follows its option
+    if (zygoteMode && zygoteFd < 0) {
+      startZygote();
+    } else if (!zygoteMode && zygoteFd >= 0) {
+      stopZygote();
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "export") == 0) {
+    // export NAME=value sets the variable in the environment of the shell and its commands, export NAME alone keeps
+    // it as it is, and without arguments the environment is listed
+    if (!enteredargs[1]) {
+      for (char **env = environ; *env; env++) {
+        printf("export %s\n", *env);
+      }
+    }
+    lastStatusType = 0;
+    lastStatus = 0;
+    for (int k = 1; enteredargs[k]; k++) {
+      char *equal = strchr(enteredargs[k], '=');
+      size_t length = equal ? (size_t)(equal - enteredargs[k]) : strlen(enteredargs[k]);
+      int valid = length > 0 && !isdigit((unsigned char)enteredargs[k][0]);
+      for (size_t n = 0; n < length && valid; n++) {
+        valid = isalnum((unsigned char)enteredargs[k][n]) || enteredargs[k][n] == '_';
+      }
+      if (!valid) {
+        printf("export: %s: not a valid name\n", enteredargs[k]);
+        lastStatus = 1;
+      } else if (equal) {
+        *equal = '\0';
+        setenv(enteredargs[k], equal + 1, 1);
+        *equal = '=';
+      }
+    }
+    fflush(stdout);
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "history") == 0) {
+    // history [n] lists the last n entries of the history, all of them without n
+    if (openHistory() == 0) {
+      syncHistory();
+      size_t first = 1;
+      if (enteredargs[1] && atoll(enteredargs[1]) >= 0 && (size_t)atoll(enteredargs[1]) < historyCount) {
+        first = historyCount - atoll(enteredargs[1]) + 1;
+      }
+      for (size_t n = first; n <= historyCount; n++) {
+        size_t length;
+        const char *entry = historyEntry(n, &length);
+        if (entry) {printf("%5zu  %.*s\n", n, (int)length, entry);}
+      }
+      fflush(stdout);
+    }
+  } else if (stageCount == 1 && strcmp(enteredargs[0], "unset") == 0) {
+    // unset NAME ... removes the variables from the environment, a name unsetenv() refuses (empty or with a =) makes
+    // the status 1 as export does for its invalid names
+    lastStatusType = 0;
+    lastStatus = 0;
+    for (int k = 1; enteredargs[k]; k++) {
+      if (unsetenv(enteredargs[k]) < 0) {
+        printf("unset: %s: not a valid name\n", enteredargs[k]);
+        lastStatus = 1;
+      }
+    }
+    fflush(stdout);
+  } else {
+    
+    // non built in commands
+    
+    int childStatus;
+    int runBg = isBg && !fgOnlyMode;
+    pid_t stagePids[MAX_ARG / 2 + 1];
+
+    // SIGTSTP is blocked in the shell, received while a foreground child runs it is handled after the child ends
+    
+    // check whether bg or fg, if bg, the children are recorded as a job and the parent continues
+    if (runBg) {
+      char *command = describeStages(stages, stageCount);
+
+      // apply the admission policy if the job cap is reached
+      if (jobCap > 0 && jobCount >= jobCap && jobPolicy == POLICY_BLOCK) {
+        while (jobCount >= jobCap) {
+          reapJobs(0, -1, NULL);
+        }
+      }
+      if (jobCap > 0 && jobCount >= jobCap && jobPolicy == POLICY_REJECT) {
+        printf("Cannot start new background process, %d processes running in the background.\n" 
+            "Please wait until a background process ends.\n", jobCount);
+        fflush(stdout);
+        free(command);
+      } else if (jobCap > 0 && (jobCount >= jobCap || queueHead)) {
+        struct queuedJob *queued = malloc(sizeof(struct queuedJob));
+        queued->stages = copyStages(stages, stageCount);
+        queued->stageCount = stageCount;
+        queued->command = command;
+        queued->limit = limit;
+        queued->next = NULL;
+        if (queueTail) {
+          queueTail->next = queued;
+        } else {
+          queueHead = queued;
+        }
+        queueTail = queued;
+        printf("background job queued, %d processes running in the background\n", jobCount);
+        fflush(stdout);
+      } else {
+        startJob(stages, stageCount, command, &limit);
+      }
+    
+    } else {
+      // fork the children of all the stages, connected with pipes
+      struct timespec started;
+      clock_gettime(CLOCK_MONOTONIC, &started);
+      int startedCount = runPipeline(stages, stageCount, 0, -1, -1, stagePids);
+      if (limit.duration > 0 && startedCount > 0) {
+        fgPids = stagePids;
+        fgCount = startedCount;
+        setDeadline(&limit, -1);
+      }
+      
+      // this is for the foreground process - wait for every stage, the last stage sets the exit/termination status
+      for (int s = 0; s < startedCount; s++) {
+        struct rusage usage;
+        pid_t w = waitChild(stagePids[s], &childStatus, &usage);
+        if (w < 0) {
+          perror("wait4");
+          continue;
+        }
+        // a reaped child is not signalled by its deadline any more
+        stagePids[s] = 0;
+        recordLatency(stages[s].args[0], elapsedUs(&started));
+        addUsage(&usage);
+        if (s != stageCount - 1) {
+          continue;
+        }
+
+        setLastStatus(childStatus);
+        if (lastStatusType) {
+          printf("terminated by signal %d\n", lastStatus);
+          fflush(stdout);
+        } 
+      }
+      fgSerial++;
+      fgPids = NULL;
+
+      // with set -e, a failed foreground command ends the shell, with its exit value (128 + signal if terminated)
+      if (errExit && (lastStatusType || lastStatus != 0)) {
+        exitShell(lastStatusType ? 128 + lastStatus : lastStatus);
+      }
+    }
+
+  }   // closing paranthesis for else statement (related to non built-in command actions)
+
+  if (redirected) {
+    restoreBuiltin(savedIn, savedOut);
+  }
+  if (timed) {
+    reportTime();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // List of the variables for the main func
+  pid_t mainpid = -5;
+  char *line;
+  size_t lineLength;
+  struct command cmd;
+  
+  // the zygote helper started by startZygote(), before anything of the shell is set up
+  if (argc == 2 && strcmp(argv[1], "--zygote") == 0) {
+    zygoteLoop(ZYGOTE_SOCKET);
+  }
+
+  // Initializations
+  fgOnlyMode = 0;
+
+  // smallsh [-e] [-c command | script]: the commands are read from the command string, the script file, or stdin
+  int argIndex = 1;
+  while (argIndex < argc && argv[argIndex][0] == '-') {
+    if (strcmp(argv[argIndex], "-e") == 0) {
+      errExit = 1;
+      argIndex++;
+    } else if (strcmp(argv[argIndex], "-c") == 0 && argIndex + 1 < argc) {
+      // the command string is split into lines in place, as if it had been read
+      inputFd = -1;
+      inputData = argv[argIndex + 1];
+      inputEnd = strlen(inputData);
+      inputEof = 1;
+      argIndex += 2;
+    } else {
+      write(2, "usage: smallsh [-e] [-c command | script]\n", 42);
+      exit(2);
+    }
+  }
+  if (inputFd == 0 && argIndex < argc) {
+    if ((inputFd = open(argv[argIndex], O_RDONLY | O_CLOEXEC)) < 0) {
+      perror(argv[argIndex]);
+      exit(127);
+    }
+  }
+  // the prompt is printed only when the commands are typed on a terminal
+  interactive = (inputFd == 0 && isatty(0));
+  historyMode = interactive;
+
+  // Obtaining process id of the parent
+  mainpid = getpid();
+
+  // Converting int to string, to be used to replace $$
+  mainpidLength = sprintf(mainpidstr, "%d", mainpid);   
+
+  // SIGINT is ignored by the shell, and by the background children which keep it through exec()
+  struct sigaction ignore_action = {0};
+  ignore_action.sa_handler = SIG_IGN;
+  sigaction(SIGINT, &ignore_action, NULL);
+
+  // SIGCHLD and SIGTSTP are received through a signalfd watched together with stdin, instead of signal handlers
+  setupEventLoop();
+
+  // the zygote helper starts with the shell when it is on by default
+  if (zygoteMode) {
+    startZygote();
+  }
+
+  // SMALLSH_TRACE=file traces the shell from the start
+  if (getenv("SMALLSH_TRACE")) {
+    traceOpen(getenv("SMALLSH_TRACE"));
+  }
+  
+  
+  // --------------------------------------------------------------------------------------------------
+  // loop asking for input until exit entered as the command
+  // --------------------------------------------------------------------------------------------------
+  
+  while (1) {
+    
+    // --------------------------------------------------------------------------------------------------
+    // Prompt for user input, check MAX_LEN not exceeded
+    // --------------------------------------------------------------------------------------------------
+   
+    // handle the signals received since the last prompt, and print : as the prompt after their notices, at once
+    handleSignals();
+    flushNotices(interactive);
+
+    // receive an input, signals received meanwhile are handled in readLine(), check the length
+    long long readNs = traceFd >= 0 ? monotonicNs() : 0;
+    line = readLine(&lineLength);
+    if (line == NULL) {
+      // the end of the input ends the shell like exit, with the status of the last command
+      if (errno != 0) {
+        perror("Command input");
+        exitShell(1);
+      }
+      exitShell(lastStatusType ? 128 + lastStatus : lastStatus);
+    }
+
+    if (lineLength > MAX_LEN){
+      write(2,"You exceeded the command length. Please try again!\n",51); 
+      continue;
+    }
+
+    // --------------------------------------------------------------------------------------------------
+    // Parse the line in a single pass into the arena: words, stages, redirections and &
+    // --------------------------------------------------------------------------------------------------
+
+    // a line typed starting with ! is replaced with an entry of the history, as long as the history is on, while a
+    // script or a command string keeps its ! as an ordinary word
+    if (interactive && historyMode && line[0] == '!' && line[1] && line[1] != ' ' && 
+        !(line = expandHistory(line, &lineLength))) {
+      continue;
+    }
+
+    // everything parsed from the previous line is released at once
+    arenaReset();
+    long long parseNs = traceFd >= 0 ? monotonicNs() : 0;
+    int parsed = parseLine(line, &cmd);
+    long long runNs = traceFd >= 0 ? monotonicNs() : 0;
+    if (readNs && traceFd >= 0) {
+      traceEvent("read", 'X', readNs, tracePid, parseNs - readNs, NULL, NULL);
+      traceEvent("parse", 'X', parseNs, tracePid, runNs - parseNs, "line", line);
+    }
+    // continue to the next prompt if the line is blank or a comment, or could not be parsed
+    if (parsed <= 0) {
+      continue;
+    }
+    if (historyMode) {
+      addHistory(line, lineLength);
+    }
+    runCommand(cmd.stages, cmd.stageCount, cmd.isBg);
+    if (runNs && traceFd >= 0) {
+      traceEvent("run", 'X', runNs, tracePid, monotonicNs() - runNs, "line", line);
+    }
+  }     // closing paranthesis for while loop
+}